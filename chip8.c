@@ -25,20 +25,46 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <stddef.h>
 #include <SDL.h>
+#ifndef YACE_BATCH
 #include <SDL_opengl.h>
+#endif
 
-#define YACE_STACK_SIZE 16
-#define YACE_ROM_SIZE 0xFFF
-#define YACE_SCREEN_WIDTH 640
-#define YACE_SCREEN_HEIGHT 320
-#define YACE_SCREEN_SCALE 10
+#include "chip8.h"
 
-// typedef unsigned int WORD;
-// typedef unsigned char BYTE;
+#if defined(__x86_64__) || defined(_M_X64)
+#define YACE_HAS_JIT
+#endif
 
-int g_redrawSignal;
+// Mapped ROM files and JIT code
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+// Fills the pages of a mapped ROM at once, where the host can
+#ifdef MAP_POPULATE
+#define YACE_MAP_POPULATE MAP_POPULATE
+#else
+#define YACE_MAP_POPULATE 0
+#endif
+
+// Computed gotos
+#if defined(__GNUC__)
+#define YACE_HAS_THREADED
+#endif
+
+// Guaranteed tail calls
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define YACE_MUSTTAIL __attribute__((musttail))
+#endif
+#endif
 
 BYTE g_font[80] =
 {
@@ -60,82 +86,24 @@ BYTE g_font[80] =
 	0xF0, 0x80, 0xF0, 0x80, 0x80  //F
 };
 
-// **********************************
-// Structure holding the Chip8 state
-// **********************************
-typedef struct _SCHIP8
-{
-	// ROM here is a file
-	FILE *ROM;
-	// RAM is 4kb
-	BYTE RAM[4096];
-	// Address register
-	WORD I;
-	// Program counter
-	WORD PC;
-	// Registers V0 - VF
-	// The VF register doubles as a carry flag
-	WORD V[16];
-	// Keyboard buttons
-	WORD Key[16];
-	// Stack (should be 12)
-	WORD Stack[YACE_STACK_SIZE];
-	// Stack pointer
-	WORD SP;
-	// Delay Timer, count down to 0 at 60Hz
-	WORD delayTimer;
-	// Sound Timer, count down to 0 at 60Hz
-	WORD soundTimer;
-	// Video Screen
-	BYTE Video[64][32][3];
-	// Window for screen
-	SDL_Window *Window;
-} SCHIP8;
-
-// *********************
-// functions prototypes
-// *********************
-void YACE_Message(void);
-void YACE_Reset(SCHIP8 *ctx);
-
-int YACE_OpenROM(SCHIP8 *ctx, char *filename);
-WORD YACE_FetchOpcode(SCHIP8 *ctx);
-void YACE_ExecuteOpcode(SCHIP8 *ctx, WORD opcode);
-
-void YACE_ShowHexROM(SCHIP8 *ctx);
-
-void YACE_InitScreen(SCHIP8 *ctx);
-void YACE_BeginScene(void);
-void YACE_Render(SCHIP8 *ctx);
-void YACE_EndScene(SCHIP8 *ctx);
-
-int YACE_GetInput(SCHIP8 *ctx);
-void YACE_PlaySound(void);
-
-void YACE_Decode0NNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_Execute1NNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_Execute2NNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_Execute3XNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_Execute4XNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_Execute5XY0Opcode(SCHIP8 *ctx, WORD opcode);
-void YACE_Execute6XNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_Execute7XNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_Decode8XYNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_Execute9XY0Opcode(SCHIP8 *ctx, WORD opcode);
-void YACE_ExecuteANNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_ExecuteBNNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_ExecuteCXNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_ExecuteDXYNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_DecodeEXNNOpcode(SCHIP8 *ctx, WORD opcode);
-void YACE_DecodeFXNNOpcode(SCHIP8 *ctx, WORD opcode);
+#ifdef YACE_HAS_JIT
+void YACE_JitFlush(SYACEJIT *jit);
+void YACE_JitInvalidate(SYACEJIT *jit, int address, int size);
+#endif
 
 // ***************
 // functions
 // ***************
 void YACE_Message(void)
 {
-	printf("YACE v0.6 BUILD 140823\n"
-		   "Usage: yace ROM\n");
+	printf("YACE v0.7 BUILD 261016\n"
+		   "Usage: yace [-engine interpreter|cached|threaded|tailcall|jit|aot|profile]\n"
+		   "            [-ips N] [-turbo FRAMES] [-rewind SECONDS] [-runahead FRAMES] [-clip]\n"
+#ifdef YACE_TRACE
+		   "            [-keymap KEYS] [-sync clock|audio] [-trace FILE] ROM\n");
+#else
+		   "            [-keymap KEYS] [-sync clock|audio] ROM\n");
+#endif
 }
 
 void YACE_Reset(SCHIP8 *ctx)
@@ -143,36 +111,124 @@ void YACE_Reset(SCHIP8 *ctx)
 	int i;
 
 	// Clear the screen
-	g_redrawSignal = 1;
-
-	memset(ctx->Video, 0, (64 * 32 * 3));
-	memset(ctx->Stack, 0, YACE_STACK_SIZE);
+	memset(ctx->Video, 0, sizeof(ctx->Video));
+	ctx->dirtyRows = YACE_ALL_ROWS;
+	memset(ctx->Stack, 0, sizeof(ctx->Stack));
 	memset(ctx->RAM, 0, YACE_ROM_SIZE);
 
 	// Copy the font in RAM
 	for (i = 0; i < 80; i++)
 		ctx->RAM[i] = g_font[i];
 
-	memset(ctx->Key, 0, 16);
+	ctx->Keys = 0;
 	ctx->I = 0;
 	ctx->PC = 0x200;
 	ctx->SP = 0;
 	ctx->delayTimer = 0;
 	ctx->soundTimer = 0;
+	YACE_SeedRandom(ctx, YACE_RANDOM_SEED);
+
+	YACE_FlushCode(ctx);
+}
+
+// CRC32 of each nibble, the byte loop takes two
+const Uint32 g_crcNibbles[16] =
+{
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+// CRC32 of the data, the same zlib and zip give
+Uint32 YACE_Crc32(const BYTE *data, int size)
+{
+	Uint32 crc = 0xFFFFFFFF;
+	int i;
+
+	for (i = 0; i < size; i++)
+	{
+		crc ^= data[i];
+		crc = (crc >> 4) ^ g_crcNibbles[crc & 0xF];
+		crc = (crc >> 4) ^ g_crcNibbles[crc & 0xF];
+	}
+
+	return ~crc;
 }
 
-int YACE_OpenROM(SCHIP8 *ctx, char *filename)
+// Copies a ROM from 0x200 and clears the program space after it,
+// returns 0 if it's empty or doesn't fit
+int YACE_LoadROM(SCHIP8 *ctx, const BYTE *data, int size)
 {
-	ctx->ROM = fopen(filename, "rb");
-	if (!ctx->ROM)
+	if (size <= 0 || size > YACE_ROM_MAX)
 		return 0;
 
-	fread(&ctx->RAM[512], 0xfff, 1, ctx->ROM);
-	fclose(ctx->ROM);
+	memcpy(&ctx->RAM[YACE_CODE_START], data, size);
+	memset(&ctx->RAM[YACE_CODE_START + size], 0, YACE_ROM_MAX - size);
+	ctx->romSize = size;
+	ctx->romCrc = YACE_Crc32(data, size);
+
+	// The previous content of the RAM was decoded
+	YACE_FlushCode(ctx);
 
 	return 1;
 }
 
+// Maps the file of a ROM and loads it, returns 0 if it can't be
+// read, is empty or doesn't fit. The size is checked before the
+// file is read.
+int YACE_OpenROM(SCHIP8 *ctx, const char *filename)
+{
+	int loaded = 0;
+#ifdef _WIN32
+	HANDLE file, mapping;
+	DWORD size, high;
+	BYTE *data;
+
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	// An empty file can't be mapped
+	size = GetFileSize(file, &high);
+	if (!high && size > 0 && size <= YACE_ROM_MAX &&
+		(mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL)
+	{
+		if ((data = (BYTE *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size)) != NULL)
+		{
+			loaded = YACE_LoadROM(ctx, data, (int)size);
+			UnmapViewOfFile(data);
+		}
+
+		CloseHandle(mapping);
+	}
+
+	CloseHandle(file);
+#else
+	struct stat info;
+	void *data;
+	int file = open(filename, O_RDONLY);
+
+	if (file < 0)
+		return 0;
+
+	// An empty file can't be mapped
+	if (!fstat(file, &info) && S_ISREG(info.st_mode) &&
+		info.st_size > 0 && info.st_size <= YACE_ROM_MAX)
+	{
+		data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE | YACE_MAP_POPULATE, file, 0);
+		if (data != MAP_FAILED)
+		{
+			loaded = YACE_LoadROM(ctx, (const BYTE *)data, (int)info.st_size);
+			munmap(data, info.st_size);
+		}
+	}
+
+	close(file);
+#endif
+
+	return loaded;
+}
+
 void YACE_ShowHexROM(SCHIP8 *ctx)
 {
 	int i,j;
@@ -186,39 +242,80 @@ void YACE_ShowHexROM(SCHIP8 *ctx)
 	}
 }
 
+// FNV-1a hash of the screen, to compare runs without looking at them
+Uint64 YACE_HashScreen(SCHIP8 *ctx)
+{
+	int i;
+	Uint64 hash = 0xCBF29CE484222325ULL;
+	const BYTE *pixels = (const BYTE *)ctx->Video;
+
+	for (i = 0; i < (int)sizeof(ctx->Video); i++)
+	{
+		hash ^= pixels[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+// Seeds the CXNN generator, the same seed replays the same numbers
+void YACE_SeedRandom(SCHIP8 *ctx, Uint64 seed)
+{
+	int i;
+
+	// splitmix64 spreads the seed over the whole state
+	for (i = 0; i < 4; i++)
+	{
+		Uint64 z = (seed += 0x9E3779B97F4A7C15ULL);
+
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		ctx->Random[i] = (Uint32)(z ^ (z >> 31));
+	}
+}
+
+// Next number of the xoshiro128** generator of the context
+Uint32 YACE_Random(SCHIP8 *ctx)
+{
+	Uint32 *s = ctx->Random;
+	Uint32 result = s[1] * 5;
+	Uint32 t = s[1] << 9;
+
+	result = (result << 7 | result >> 25) * 9;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = s[3] << 11 | s[3] >> 21;
+
+	return result;
+}
+
+// Addresses from PC and I wrap around the 4kb of RAM
 WORD YACE_FetchOpcode(SCHIP8 *ctx)
 {
-	int opcode = ((ctx->RAM[ctx->PC] << 8) | ctx->RAM[ctx->PC + 1]);
+	int opcode = ((ctx->RAM[ctx->PC & 0xFFF] << 8) | ctx->RAM[(ctx->PC + 1) & 0xFFF]);
 	ctx->PC += 2;
 	return (opcode & 0xffff);
 }
 
 void YACE_Decode0NNNOpcode(SCHIP8 *ctx, WORD opcode)
 {
-	int x, y;
-
 	switch (opcode & 0xf)
 	{
 		// Clears the screen.
 		case 0x0:
-		{
-			for (x = 0; x < 64; x++)
-			{
-				for (y = 0; y < 32; y++)
-				{
-					ctx->Video[x][y][0] = 0;
-					ctx->Video[x][y][1] = 0;
-					ctx->Video[x][y][2] = 0;
-				}
-			}
-		} break;
+			YACE_ClearScreen(ctx);
+			break;
 		// Returns from a subroutine.
 		case 0xE:
 		{
 			// Decrease the stack pointer first
 			ctx->SP--;
 			// then store jump
-			ctx->PC = ctx->Stack[ctx->SP];
+			ctx->PC = ctx->Stack[ctx->SP & (YACE_STACK_SIZE - 1)];
 		} break;
 	}
 }
@@ -232,7 +329,7 @@ void YACE_Execute1NNNOpcode(SCHIP8 *ctx, WORD opcode)
 // Calls subroutine at NNN.
 void YACE_Execute2NNNOpcode(SCHIP8 *ctx, WORD opcode)
 {
-	ctx->Stack[ctx->SP] = ctx->PC;
+	ctx->Stack[ctx->SP & (YACE_STACK_SIZE - 1)] = ctx->PC;
 	ctx->SP++;
 	ctx->PC = (opcode & 0x0FFF);
 }
@@ -360,48 +457,21 @@ void YACE_ExecuteBNNNOpcode(SCHIP8 *ctx, WORD opcode)
 	ctx->PC = ctx->V[0] + (opcode & 0x0FFF);
 }
 
-// Sets VX to a random number and NN.
+// Sets VX to a random byte and NN.
 void YACE_ExecuteCXNNOpcode(SCHIP8 *ctx, WORD opcode)
 {
-	ctx->V[(opcode & 0x0F00) >> 8] = rand() + (opcode & 0x00FF);
+	ctx->V[(opcode & 0x0F00) >> 8] = (YACE_Random(ctx) >> 24) & (opcode & 0x00FF);
 }
 
 // Sprites stored in memory at location in index register (I),
-// maximum 8bits wide. Wraps around the screen. If when drawn,
+// maximum 8bits wide. Wraps around the screen, or is clipped
+// at its edges when the clip quirk is set. If when drawn,
 // clears a pixel, register VF is set to 1 otherwise it is zero.
 // All drawing is XOR drawing (e.g. it toggles the screen pixels)
 void YACE_ExecuteDXYNOpcode(SCHIP8 *ctx, WORD opcode)
 {
-	WORD yline, xline;
-	WORD xcoord = ctx->V[(opcode & 0x0F00) >> 8];
-	WORD ycoord = ctx->V[(opcode & 0x00F0) >> 4];
-	WORD height = opcode & 0x000F;
-
-	ctx->V[0xF] = 0;
-
-	for (yline = 0; yline < height; yline++)
-	{
-		// Get the pixel to draw
-		BYTE data = ctx->RAM[ctx->I + yline];
-		
-		for (xline = 0; xline < 8; xline++)
-		{
-			if ((data & (128 >> xline)) != 0)
-			{
-				WORD x = (xline + xcoord) % 32;
-				WORD y = (yline + ycoord) % 64;
-
-				if (ctx->Video[y][x][0] == 0xFF)
-					ctx->V[0xF] = 1;
-
-				ctx->Video[y][x][0] ^= 0xFF;
-				ctx->Video[y][x][1] ^= 0xFF;
-				ctx->Video[y][x][2] ^= 0xFF;
-
-				g_redrawSignal = 1;
-			}
-		}
-	}
+	YACE_DrawSprite(ctx, ctx->V[(opcode & 0x0F00) >> 8],
+		ctx->V[(opcode & 0x00F0) >> 4], opcode & 0x000F);
 }
 
 void YACE_DecodeEXNNOpcode(SCHIP8 *ctx, WORD opcode)
@@ -413,13 +483,13 @@ void YACE_DecodeEXNNOpcode(SCHIP8 *ctx, WORD opcode)
 		// Skips the next instruction if the key stored in VX is pressed.
 		case 0x9E:
 		{
-			if (ctx->Key[index] == 1)
+			if (YACE_KEY_DOWN(ctx, index))
 				ctx->PC += 2;
 		} break;
 		// Skips the next instruction if the key stored in VX isn't pressed.
 		case 0xA1:
 		{
-			if (ctx->Key[index] != 1)
+			if (!YACE_KEY_DOWN(ctx, index))
 				ctx->PC += 2;
 		} break;
 	}
@@ -435,14 +505,8 @@ void YACE_DecodeFXNNOpcode(SCHIP8 *ctx, WORD opcode)
 			break;
 		// A key press is awaited, and then stored in VX.
 		case 0x0A:
-		{
-			int k = YACE_GetInput(ctx);
-
-			if (k == -1)
-				ctx->PC -= 2;
-			else
-				ctx->V[(opcode & 0x0F00) >> 8] = k;
-		} break;
+			YACE_WaitKey(ctx, (opcode & 0x0F00) >> 8);
+			break;
 		// Sets the delay timer to VX.
 		case 0x15:
 			ctx->delayTimer = ctx->V[(opcode & 0x0F00) >> 8];
@@ -454,15 +518,17 @@ void YACE_DecodeFXNNOpcode(SCHIP8 *ctx, WORD opcode)
 		// Adds VX to I.
 		// VF is set to 1 when range overflow (I+VX>0xFFF), and 0 when there isn't.
 		// This is undocumented feature of the Chip-8 and used by Spacefight 2019! game.
+		// I then wraps around the RAM.
 		case 0x1E:
 		{
-			ctx->I += ctx->V[(opcode & 0x0F00) >> 8];
+			int index = ctx->I + ctx->V[(opcode & 0x0F00) >> 8];
 
-			if (ctx->I + ctx->V[(opcode & 0x0F00) >> 8] > 0xFFF)
+			if (index > 0xFFF)
 				ctx->V[0xF] = 1;
 			else
 				ctx->V[0xF] = 0;
 
+			ctx->I = index & 0xFFF;
 		} break;
 		// Sets I to the location of the sprite for the character in VX.
 		// Characters 0-F (in hexadecimal) are represented by a 4x5 font.
@@ -476,37 +542,18 @@ void YACE_DecodeFXNNOpcode(SCHIP8 *ctx, WORD opcode)
 		// place the hundreds digit in memory at location in I,
 		// the tens digit at location I+1, and the ones digit at location I+2.)
 		case 0x33:
-		{
-			int value = ctx->V[(opcode & 0x0F00) >> 8];
-
-			ctx->RAM[ctx->I + 0] = value / 100;
-			ctx->RAM[ctx->I + 1] = (value / 10) % 10;
-			ctx->RAM[ctx->I + 2] = value % 10;
-		} break;
+			YACE_StoreBCD(ctx, ctx->V[(opcode & 0x0F00) >> 8]);
+			break;
 		// Stores V0 to VX in memory starting at address I.
 		// On the original interpreter, when the operation is done, I=I+X+1.
 		case 0x55:
-		{
-			int i;
-			int N = (opcode & 0x0F00) >> 8;
-
-			for (i = 0; i <= N; i++)
-				ctx->RAM[i + ctx->I] = ctx->V[i];
-
-			ctx->I = ctx->I + N + 1;
-		} break;
+			YACE_StoreRegisters(ctx, (opcode & 0x0F00) >> 8);
+			break;
 		// Fills V0 to VX with values from memory starting at address I.
 		// On the original interpreter, when the operation is done, I=I+X+1.
 		case 0x65:
-		{
-			int i;
-			int N = (opcode & 0x0F00) >> 8;
-
-			for (i = 0; i <= N; i++)
-				ctx->V[i] = ctx->RAM[i + ctx->I];
-
-			ctx->I = ctx->I + N + 1;
-		} break;
+			YACE_LoadRegisters(ctx, (opcode & 0x0F00) >> 8);
+			break;
 	}
 }
 
@@ -537,207 +584,3686 @@ void YACE_ExecuteOpcode(SCHIP8 *ctx, WORD opcode)
 	}
 }
 
-// Returns the index of the key pressed, if any
-int YACE_GetInput(SCHIP8 *ctx)
+// *******************************************************
+// Opcode helpers shared by every execution engine
+// *******************************************************
+
+// Clears the screen.
+void YACE_ClearScreen(SCHIP8 *ctx)
 {
-	int key = -1;
-	SDL_Event evt;
-	SDL_PollEvent(&evt);
+	memset(ctx->Video, 0, sizeof(ctx->Video));
+	ctx->dirtyRows = YACE_ALL_ROWS;
+}
+
+// Draws a sprite of the given height from I at the given coordinates,
+// VF is set when a pixel is cleared. Each line of the sprite is rotated
+// into place on its screen row, so the pixels past the right edge wrap
+// around, then XORed in a single operation. With the clip quirk it's
+// shifted instead, and the lines past the bottom edge aren't drawn;
+// the sprite still starts at the coordinates modulo the screen size.
+void YACE_DrawSprite(SCHIP8 *ctx, WORD xcoord, WORD ycoord, WORD height)
+{
+	WORD yline;
+	int shift = xcoord % YACE_VIDEO_WIDTH;
+	int top = ycoord % YACE_VIDEO_HEIGHT;
+	Uint64 cleared = 0;
+
+	if (ctx->clip && top + height > YACE_VIDEO_HEIGHT)
+		height = YACE_VIDEO_HEIGHT - top;
 
-	switch (evt.type)
+	for (yline = 0; yline < height; yline++)
 	{
-		case SDL_QUIT:
-			exit(0);
-			break;
+		int y = (yline + top) % YACE_VIDEO_HEIGHT;
+		// Get the pixels to draw, the leftmost in bit 63
+		Uint64 data = (Uint64)ctx->RAM[(ctx->I + yline) & 0xFFF] << 56;
+		Uint64 sprite = data >> shift;
 
-		case SDL_KEYUP:
-		{
-			switch (evt.key.keysym.sym)
-			{
-				case SDLK_LEFT:
-					key = 9;
-					break;
-				case SDLK_UP:
-					key = 1;
-					break;
-				case SDLK_RIGHT:
-					key = 6;
-					break;
-				case SDLK_DOWN:
-					key = 4;
-					break;
-			}
+		if (!ctx->clip)
+			sprite |= data << ((64 - shift) & 63);
 
-			if (key != -1)
-			{
-				ctx->Key[key] = 0;
-				key = -1;
-			}
+		cleared |= ctx->Video[y] & sprite;
+		ctx->Video[y] ^= sprite;
 
-		} break;
+		if (sprite)
+			ctx->dirtyRows |= (Uint32)1 << y;
+	}
 
-		case SDL_KEYDOWN:
-		{
-			switch (evt.key.keysym.sym)
-			{
-				case SDLK_LEFT:
-					key = 9;
-					break;
-				case SDLK_UP:
-					key = 1;
-					break;
-				case SDLK_RIGHT:
-					key = 6;
-					break;
-				case SDLK_DOWN:
-					key = 4;
-					break;
-			}
+	ctx->V[0xF] = (cleared != 0);
+}
 
-			if (key != -1)
-				ctx->Key[key] = 1;
-		}
+
+// A key press is awaited, and then stored in VX.
+// Returns 0 if there was none, PC is rewound to wait again.
+int YACE_WaitKey(SCHIP8 *ctx, int x)
+{
+	int k = YACE_GetInput(ctx);
+
+	if (k == -1)
+	{
+		ctx->PC -= 2;
+		return 0;
 	}
 
-	return key;
+	ctx->V[x] = k;
+	return 1;
 }
 
-void YACE_InitScreen(SCHIP8 *ctx)
+// Stores the BCD representation of value at I, I+1 and I+2.
+void YACE_StoreBCD(SCHIP8 *ctx, int value)
 {
-	int x, y;
+	ctx->RAM[ctx->I & 0xFFF] = value / 100;
+	ctx->RAM[(ctx->I + 1) & 0xFFF] = (value / 10) % 10;
+	ctx->RAM[(ctx->I + 2) & 0xFFF] = value % 10;
 
-	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
+	YACE_InvalidateCode(ctx, ctx->I, 3);
+}
 
-	ctx->Window = SDL_CreateWindow("Yace",
-		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-		YACE_SCREEN_WIDTH, YACE_SCREEN_HEIGHT,
-		SDL_WINDOW_OPENGL);
+// Stores V0 to VN in memory starting at address I, then I=I+N+1.
+void YACE_StoreRegisters(SCHIP8 *ctx, int N)
+{
+	int i;
 
-	SDL_GL_CreateContext(ctx->Window);
+	for (i = 0; i <= N; i++)
+		ctx->RAM[(i + ctx->I) & 0xFFF] = ctx->V[i];
 
-	glViewport(0, 0, YACE_SCREEN_WIDTH, YACE_SCREEN_HEIGHT);
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	glOrtho(0, YACE_SCREEN_WIDTH, YACE_SCREEN_HEIGHT, 0, -1.0, 1.0);
-	glClearColor(0x40, 0x40, 0x40, 1.0);
+	YACE_InvalidateCode(ctx, ctx->I, N + 1);
+	ctx->I = (ctx->I + N + 1) & 0xFFF;
+}
 
-	glEnable(GL_TEXTURE_2D);
-	glDisable(GL_BLEND);
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
-	glDisable(GL_DITHER);
+// Fills V0 to VN with values from memory starting at address I, then I=I+N+1.
+void YACE_LoadRegisters(SCHIP8 *ctx, int N)
+{
+	int i;
 
-	for (x = 0; x < 64; x++)
-	{
-		for (y = 0; y < 32; y++)
-		{
-			ctx->Video[x][y][0] = 0;
-			ctx->Video[x][y][1] = 0;
-			ctx->Video[x][y][2] = 0;
-		}
-	}
+	for (i = 0; i <= N; i++)
+		ctx->V[i] = ctx->RAM[(i + ctx->I) & 0xFFF];
 
-	// ******************************************
-	// Create the texture using the video memory
-	// ******************************************
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, 32, 64,
-		0, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)ctx->Video);
+	ctx->I = (ctx->I + N + 1) & 0xFFF;
+}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+// *******************************************************
+// Idle loops
+//
+// Loops polling the delay timer or the keys, jumps to self and
+// FX0A waiting for a key repeat the same iteration until the
+// next frame, since timers and keys only change between calls
+// of YACE_Run. The predecoded operations detecting them stop
+// the engine, then YACE_Run charges the whole iterations left
+// and runs the remainder, so the guest ends exactly where it
+// would have without burning the host cycles.
+// *******************************************************
+
+// Returned by an operation stopping the engine, larger than any budget
+#define YACE_IDLE_CYCLES (1 << 24)
+
+// The guest is idle in a loop of the given number of instructions,
+// that were just executed
+int YACE_Idle(SCHIP8 *ctx, int length)
+{
+	ctx->idle = length;
+	return YACE_IDLE_CYCLES;
 }
 
-void YACE_BeginScene(void)
+// *******************************************************
+// Predecoded instructions
+//
+// Every address from 0x200 owns a slot holding the handler
+// and the operands of the instruction starting there, so an
+// opcode is decoded only the first time it's executed.
+// Slots start with YACE_OpDecode and go back to it when the
+// guest writes over them (FX33, FX55).
+//
+// When decoded, a slot may be fused with the following ones
+// into a superinstruction if they form a common idiom (see
+// YACE_FuseInstruction); the profile engine reports the most
+// executed pairs and triples to choose them.
+// *******************************************************
+
+// Every operation but YACE_OP_Decode, OP(name) is expanded
+// once for each handler YACE_Op##name
+#define YACE_FOREACH_OP(OP) \
+	OP(Nop) OP(00E0) OP(00EE) OP(1NNN) OP(2NNN) OP(3XNN) OP(4XNN) \
+	OP(5XY0) OP(6XNN) OP(7XNN) OP(8XY0) OP(8XY1) OP(8XY2) OP(8XY3) \
+	OP(8XY4) OP(8XY5) OP(8XY6) OP(8XY7) OP(8XYE) OP(9XY0) OP(ANNN) \
+	OP(BNNN) OP(CXNN) OP(DXYN) OP(EX9E) OP(EXA1) OP(FX07) OP(FX0A) \
+	OP(FX15) OP(FX18) OP(FX1E) OP(FX29) OP(FX33) OP(FX55) OP(FX65) \
+	OP(ANNN_DXYN) OP(6XNN_6XNN) OP(7XNN_3XNN_1NNN) OP(7XNN_4XNN_1NNN) \
+	OP(FX65_ALU) OP(1NNN_SELF) OP(FX07_3XNN_1NNN) OP(FX07_4XNN_1NNN) \
+	OP(EX9E_1NNN) OP(EXA1_1NNN)
+
+// Longest superinstruction, in opcodes
+#define YACE_MAX_FUSED 3
+
+#define YACE_OP_ENUM(name) YACE_OP_##name,
+#define YACE_OP_HANDLER(name) YACE_Op##name,
+#define YACE_OP_NAME(name) #name,
+
+// Operations of the predecoded slots
+enum
+{
+	YACE_OP_Decode,
+	YACE_FOREACH_OP(YACE_OP_ENUM)
+	YACE_OP_COUNT
+};
+
+int YACE_OpDecode(SCHIP8 *ctx, SYACEINST *inst);
+int YACE_UnfusedOp(int op);
+extern YACE_OPHANDLER g_opHandlers[YACE_OP_COUNT];
+
+// Clears the screen.
+int YACE_Op00E0(SCHIP8 *ctx, SYACEINST *inst)
 {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	YACE_ClearScreen(ctx);
+	return 1;
 }
 
-void YACE_Render(SCHIP8 *ctx)
+// Returns from a subroutine.
+int YACE_Op00EE(SCHIP8 *ctx, SYACEINST *inst)
 {
-	// fill the texture now
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
-		32, 64,
-		GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)ctx->Video);
+	ctx->SP--;
+	ctx->PC = ctx->Stack[ctx->SP & (YACE_STACK_SIZE - 1)];
+	return 1;
+}
 
-	glBegin(GL_QUADS);
-		glTexCoord2d(0.0, 0.0);	glVertex2d(0.0, 0.0);
-		glTexCoord2d(1.0, 0.0);	glVertex2d(YACE_SCREEN_WIDTH, 0.0);
-		glTexCoord2d(1.0, 1.0);	glVertex2d(YACE_SCREEN_WIDTH, YACE_SCREEN_WIDTH);
-		glTexCoord2d(0.0, 1.0);	glVertex2d(0.0, YACE_SCREEN_WIDTH);
-	glEnd();
+// Opcodes doing nothing (0NNN and the unknown ones)
+int YACE_OpNop(SCHIP8 *ctx, SYACEINST *inst)
+{
+	return 1;
 }
 
-void YACE_EndScene(SCHIP8 *ctx)
+// Jumps to address NNN.
+int YACE_Op1NNN(SCHIP8 *ctx, SYACEINST *inst)
 {
-	SDL_GL_SwapWindow(ctx->Window);
-	glFlush();
+	ctx->PC = inst->nnn;
+	return 1;
 }
 
-void YACE_PlaySound(void)
+// Calls subroutine at NNN.
+int YACE_Op2NNN(SCHIP8 *ctx, SYACEINST *inst)
 {
-	// printf("\a");
+	ctx->Stack[ctx->SP & (YACE_STACK_SIZE - 1)] = ctx->PC;
+	ctx->SP++;
+	ctx->PC = inst->nnn;
+	return 1;
 }
 
-void YACE_Loop(SCHIP8 *ctx)
+// Skips the next instruction if VX equals NN.
+int YACE_Op3XNN(SCHIP8 *ctx, SYACEINST *inst)
 {
-	int i;
-	int done = 0;
-	unsigned int t2;
-	float update_rate = 1000 / 60;
-	float opcode_per_sec = 400 / 60;
-	unsigned int t = SDL_GetTicks();
+	if (ctx->V[inst->x] == inst->nn)
+		ctx->PC += 2;
+	return 1;
+}
 
-	while (!done)
-	{
-		YACE_GetInput(ctx);
+// Skips the next instruction if VX doesn't equal NN.
+int YACE_Op4XNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	if (ctx->V[inst->x] != inst->nn)
+		ctx->PC += 2;
+	return 1;
+}
 
-		t2 = SDL_GetTicks();
+// Skips the next instruction if VX equals VY.
+int YACE_Op5XY0(SCHIP8 *ctx, SYACEINST *inst)
+{
+	if (ctx->V[inst->x] == ctx->V[inst->y])
+		ctx->PC += 2;
+	return 1;
+}
 
-		// If 1000/60 passed, update the CPU
-		if ((t + update_rate) < t2)
-		{
-			if (ctx->delayTimer > 0) ctx->delayTimer--;
-			if (ctx->soundTimer > 0) ctx->soundTimer--;
-			if (ctx->soundTimer > 0) YACE_PlaySound();
+// Sets VX to NN.
+int YACE_Op6XNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] = inst->nn;
+	return 1;
+}
 
-			for (i = 0; i < opcode_per_sec; i++)
-			{
-				WORD opcode = YACE_FetchOpcode(ctx);
-				printf("OPCODE: %04x\n", opcode);
-				YACE_ExecuteOpcode(ctx, opcode);
-			}
+// Adds NN to VX.
+int YACE_Op7XNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] += inst->nn;
+	return 1;
+}
 
-			t = t2;
+// Sets VX to the value of VY.
+int YACE_Op8XY0(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] = ctx->V[inst->y];
+	return 1;
+}
 
-			if (g_redrawSignal)
-			{
-				YACE_BeginScene();
-				YACE_Render(ctx);
-				YACE_EndScene(ctx);
-			}
-		}
-	}
+// Sets VX to VX or VY.
+int YACE_Op8XY1(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] |= ctx->V[inst->y];
+	return 1;
 }
 
-int main(int argc, char *argv[])
+// Sets VX to VX and VY.
+int YACE_Op8XY2(SCHIP8 *ctx, SYACEINST *inst)
 {
-	SCHIP8 *emu = (SCHIP8 *)malloc(sizeof(SCHIP8));
+	ctx->V[inst->x] &= ctx->V[inst->y];
+	return 1;
+}
 
-	srand(time(NULL));
-	// First reset the emulator state
-	YACE_Reset(emu);
-	
-	if (argc < 2)
-		YACE_Message();
+// Sets VX to VX xor VY.
+int YACE_Op8XY3(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] ^= ctx->V[inst->y];
+	return 1;
+}
 
-	// load the ROM in RAM starting from 0x200 until 0xfff
-	YACE_OpenROM(emu, argv[1]);
-	YACE_InitScreen(emu);
+// Adds VY to VX, VF is the carry.
+int YACE_Op8XY4(SCHIP8 *ctx, SYACEINST *inst)
+{
+	int value = ctx->V[inst->x] + ctx->V[inst->y];
 
-	YACE_Loop(emu);
+	ctx->V[0xF] = (value > 0xFF);
+	ctx->V[inst->x] = value;
+	return 1;
+}
 
-	free(emu);
-	return 0;
+// VY is subtracted from VX, VF is 0 when there's a borrow.
+int YACE_Op8XY5(SCHIP8 *ctx, SYACEINST *inst)
+{
+	int value = ctx->V[inst->x] - ctx->V[inst->y];
+
+	ctx->V[0xF] = (value > 0);
+	ctx->V[inst->x] = value;
+	return 1;
 }
+
+// Shifts VX right by one, VF is the least significant bit before the shift.
+int YACE_Op8XY6(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[0xF] = ctx->V[inst->x] & 0x0001;
+	ctx->V[inst->x] >>= 1;
+	return 1;
+}
+
+// Sets VX to VY minus VX, VF is 0 when there's a borrow.
+int YACE_Op8XY7(SCHIP8 *ctx, SYACEINST *inst)
+{
+	int value = ctx->V[inst->y] - ctx->V[inst->x];
+
+	ctx->V[inst->x] = value;
+	ctx->V[0xF] = (value >= 0);
+	return 1;
+}
+
+// Shifts VX left by one, VF is the most significant bit before the shift.
+int YACE_Op8XYE(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[0xF] = ctx->V[inst->x] >> 7;
+	ctx->V[inst->x] <<= 1;
+	return 1;
+}
+
+// Skips the next instruction if VX doesn't equal VY.
+int YACE_Op9XY0(SCHIP8 *ctx, SYACEINST *inst)
+{
+	if (ctx->V[inst->x] != ctx->V[inst->y])
+		ctx->PC += 2;
+	return 1;
+}
+
+// Sets I to the address NNN.
+int YACE_OpANNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->I = inst->nnn;
+	return 1;
+}
+
+// Jumps to the address NNN plus V0.
+int YACE_OpBNNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->PC = ctx->V[0] + inst->nnn;
+	return 1;
+}
+
+// Sets VX to a random byte and NN.
+int YACE_OpCXNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] = (YACE_Random(ctx) >> 24) & inst->nn;
+	return 1;
+}
+
+// Draws a sprite at VX, VY.
+int YACE_OpDXYN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	YACE_DrawSprite(ctx, ctx->V[inst->x], ctx->V[inst->y], inst->n);
+	return 1;
+}
+
+// Skips the next instruction if the key stored in VX is pressed.
+int YACE_OpEX9E(SCHIP8 *ctx, SYACEINST *inst)
+{
+	if (YACE_KEY_DOWN(ctx, ctx->V[inst->x]))
+		ctx->PC += 2;
+	return 1;
+}
+
+// Skips the next instruction if the key stored in VX isn't pressed.
+int YACE_OpEXA1(SCHIP8 *ctx, SYACEINST *inst)
+{
+	if (!YACE_KEY_DOWN(ctx, ctx->V[inst->x]))
+		ctx->PC += 2;
+	return 1;
+}
+
+// Sets VX to the value of the delay timer.
+int YACE_OpFX07(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] = ctx->delayTimer;
+	return 1;
+}
+
+// A key press is awaited, and then stored in VX.
+int YACE_OpFX0A(SCHIP8 *ctx, SYACEINST *inst)
+{
+	if (!YACE_WaitKey(ctx, inst->x))
+		return YACE_Idle(ctx, 1);
+	return 1;
+}
+
+// Sets the delay timer to VX.
+int YACE_OpFX15(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->delayTimer = ctx->V[inst->x];
+	return 1;
+}
+
+// Sets the sound timer to VX.
+int YACE_OpFX18(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->soundTimer = ctx->V[inst->x];
+	return 1;
+}
+
+// Adds VX to I, VF is set on range overflow (see YACE_DecodeFXNNOpcode).
+int YACE_OpFX1E(SCHIP8 *ctx, SYACEINST *inst)
+{
+	int index = ctx->I + ctx->V[inst->x];
+
+	ctx->V[0xF] = (index > 0xFFF);
+	ctx->I = index & 0xFFF;
+	return 1;
+}
+
+// Sets I to the location of the font sprite for VX.
+int YACE_OpFX29(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->I = ctx->V[inst->x] * 5;
+	return 1;
+}
+
+// Stores the BCD representation of VX at I.
+int YACE_OpFX33(SCHIP8 *ctx, SYACEINST *inst)
+{
+	YACE_StoreBCD(ctx, ctx->V[inst->x]);
+	return 1;
+}
+
+// Stores V0 to VX in memory starting at address I.
+int YACE_OpFX55(SCHIP8 *ctx, SYACEINST *inst)
+{
+	YACE_StoreRegisters(ctx, inst->x);
+	return 1;
+}
+
+// Fills V0 to VX with values from memory starting at address I.
+int YACE_OpFX65(SCHIP8 *ctx, SYACEINST *inst)
+{
+	YACE_LoadRegisters(ctx, inst->x);
+	return 1;
+}
+
+// Sets I to NNN, then draws a sprite (ANNN DXYN).
+int YACE_OpANNN_DXYN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	SYACEINST *draw = inst + 2;
+
+	ctx->I = inst->nnn;
+	ctx->PC += 2;
+	YACE_DrawSprite(ctx, ctx->V[draw->x], ctx->V[draw->y], draw->n);
+	return 2;
+}
+
+// Sets two registers (6XNN 6XNN).
+int YACE_Op6XNN_6XNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] = inst->nn;
+	ctx->V[inst[2].x] = inst[2].nn;
+	ctx->PC += 2;
+	return 2;
+}
+
+// Counted loop: adds to the counter, then jumps back
+// unless it reached the end value (7XNN 3XNN 1NNN).
+int YACE_Op7XNN_3XNN_1NNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] += inst->nn;
+
+	if (ctx->V[inst[2].x] == inst[2].nn)
+	{
+		ctx->PC += 4;
+		return 2;
+	}
+
+	ctx->PC = inst[4].nnn;
+	return 3;
+}
+
+// Same as above, looping while the counter equals the value (7XNN 4XNN 1NNN).
+int YACE_Op7XNN_4XNN_1NNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] += inst->nn;
+
+	if (ctx->V[inst[2].x] != inst[2].nn)
+	{
+		ctx->PC += 4;
+		return 2;
+	}
+
+	ctx->PC = inst[4].nnn;
+	return 3;
+}
+
+// Loads registers, then runs the arithmetic on them (FX65 7XNN/8XYN).
+// The arithmetic slot may start a superinstruction itself, only its
+// first instruction is run.
+int YACE_OpFX65_ALU(SCHIP8 *ctx, SYACEINST *inst)
+{
+	YACE_LoadRegisters(ctx, inst->x);
+	ctx->PC += 2;
+	return 1 + g_opHandlers[YACE_UnfusedOp(inst[2].op)](ctx, inst + 2);
+}
+
+// Jumps to itself (1NNN).
+int YACE_Op1NNN_SELF(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->PC = inst->nnn;
+	return YACE_Idle(ctx, 1);
+}
+
+// Waits for the delay timer to reach the value (FX07 3XNN 1NNN).
+int YACE_OpFX07_3XNN_1NNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] = ctx->delayTimer;
+
+	if (ctx->V[inst->x] == inst[2].nn)
+	{
+		ctx->PC += 4;
+		return 2;
+	}
+
+	ctx->PC = inst[4].nnn;
+	return YACE_Idle(ctx, 3);
+}
+
+// Waits for the delay timer to leave the value (FX07 4XNN 1NNN).
+int YACE_OpFX07_4XNN_1NNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	ctx->V[inst->x] = ctx->delayTimer;
+
+	if (ctx->V[inst->x] != inst[2].nn)
+	{
+		ctx->PC += 4;
+		return 2;
+	}
+
+	ctx->PC = inst[4].nnn;
+	return YACE_Idle(ctx, 3);
+}
+
+// Waits for the key to be pressed (EX9E 1NNN).
+int YACE_OpEX9E_1NNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	if (YACE_KEY_DOWN(ctx, ctx->V[inst->x]))
+	{
+		ctx->PC += 2;
+		return 1;
+	}
+
+	ctx->PC = inst[2].nnn;
+	return YACE_Idle(ctx, 2);
+}
+
+// Waits for the key to be released (EXA1 1NNN).
+int YACE_OpEXA1_1NNN(SCHIP8 *ctx, SYACEINST *inst)
+{
+	if (!YACE_KEY_DOWN(ctx, ctx->V[inst->x]))
+	{
+		ctx->PC += 2;
+		return 1;
+	}
+
+	ctx->PC = inst[2].nnn;
+	return YACE_Idle(ctx, 2);
+}
+
+// Handlers of the operations, indexed by YACE_OP_*
+YACE_OPHANDLER g_opHandlers[YACE_OP_COUNT] =
+{
+	YACE_OpDecode,
+	YACE_FOREACH_OP(YACE_OP_HANDLER)
+};
+
+// Names of the operations, indexed by YACE_OP_*
+const char *g_opNames[YACE_OP_COUNT] =
+{
+	"Decode",
+	YACE_FOREACH_OP(YACE_OP_NAME)
+};
+
+// Fills the slot with the handler and the operands of the opcode
+void YACE_DecodeInstruction(SYACEINST *inst, WORD opcode)
+{
+	int op = YACE_OP_Nop;
+
+	inst->nnn = opcode & 0x0FFF;
+	inst->x = (opcode & 0x0F00) >> 8;
+	inst->y = (opcode & 0x00F0) >> 4;
+	inst->nn = opcode & 0x00FF;
+	inst->n = opcode & 0x000F;
+
+	switch (opcode & 0xF000)
+	{
+		case 0x0000:
+		{
+			if (inst->n == 0x0)
+				op = YACE_OP_00E0;
+			else if (inst->n == 0xE)
+				op = YACE_OP_00EE;
+		} break;
+		case 0x1000: op = YACE_OP_1NNN; break;
+		case 0x2000: op = YACE_OP_2NNN; break;
+		case 0x3000: op = YACE_OP_3XNN; break;
+		case 0x4000: op = YACE_OP_4XNN; break;
+		case 0x5000: op = YACE_OP_5XY0; break;
+		case 0x6000: op = YACE_OP_6XNN; break;
+		case 0x7000: op = YACE_OP_7XNN; break;
+		case 0x8000:
+		{
+			switch (inst->n)
+			{
+				case 0x0: op = YACE_OP_8XY0; break;
+				case 0x1: op = YACE_OP_8XY1; break;
+				case 0x2: op = YACE_OP_8XY2; break;
+				case 0x3: op = YACE_OP_8XY3; break;
+				case 0x4: op = YACE_OP_8XY4; break;
+				case 0x5: op = YACE_OP_8XY5; break;
+				case 0x6: op = YACE_OP_8XY6; break;
+				case 0x7: op = YACE_OP_8XY7; break;
+				case 0xE: op = YACE_OP_8XYE; break;
+			}
+		} break;
+		case 0x9000: op = YACE_OP_9XY0; break;
+		case 0xA000: op = YACE_OP_ANNN; break;
+		case 0xB000: op = YACE_OP_BNNN; break;
+		case 0xC000: op = YACE_OP_CXNN; break;
+		case 0xD000: op = YACE_OP_DXYN; break;
+		case 0xE000:
+		{
+			if (inst->nn == 0x9E)
+				op = YACE_OP_EX9E;
+			else if (inst->nn == 0xA1)
+				op = YACE_OP_EXA1;
+		} break;
+		case 0xF000:
+		{
+			switch (inst->nn)
+			{
+				case 0x07: op = YACE_OP_FX07; break;
+				case 0x0A: op = YACE_OP_FX0A; break;
+				case 0x15: op = YACE_OP_FX15; break;
+				case 0x18: op = YACE_OP_FX18; break;
+				case 0x1E: op = YACE_OP_FX1E; break;
+				case 0x29: op = YACE_OP_FX29; break;
+				case 0x33: op = YACE_OP_FX33; break;
+				case 0x55: op = YACE_OP_FX55; break;
+				case 0x65: op = YACE_OP_FX65; break;
+			}
+		} break;
+	}
+
+	inst->op = op;
+	inst->handler = g_opHandlers[op];
+	inst->length = 1;
+}
+
+// Turns the slot into a superinstruction when it starts one of
+// the idioms below. The slots it covers are decoded as well,
+// the fused handlers read their operands.
+void YACE_FuseInstruction(SCHIP8 *ctx, SYACEINST *inst)
+{
+	int i;
+	int op = inst->op;
+	int length = 1;
+	int slot = (int)(inst - ctx->Engines->Code);
+	int address = YACE_CODE_START + slot;
+	WORD next[YACE_MAX_FUSED];
+
+	// Every opcode must fit in the slots
+	for (i = 1; i < YACE_MAX_FUSED && slot + i * 2 < YACE_CODE_SLOTS - 1; i++)
+		next[i] = (ctx->RAM[address + i * 2] << 8) | ctx->RAM[address + i * 2 + 1];
+
+	for (; i < YACE_MAX_FUSED; i++)
+		next[i] = 0;
+
+	switch (op)
+	{
+		case YACE_OP_ANNN:
+		{
+			if ((next[1] & 0xF000) == 0xD000)
+				op = YACE_OP_ANNN_DXYN, length = 2;
+		} break;
+		case YACE_OP_6XNN:
+		{
+			if ((next[1] & 0xF000) == 0x6000)
+				op = YACE_OP_6XNN_6XNN, length = 2;
+		} break;
+		case YACE_OP_7XNN:
+		{
+			if ((next[2] & 0xF000) != 0x1000)
+				break;
+
+			if ((next[1] & 0xF000) == 0x3000)
+				op = YACE_OP_7XNN_3XNN_1NNN, length = 3;
+			else if ((next[1] & 0xF000) == 0x4000)
+				op = YACE_OP_7XNN_4XNN_1NNN, length = 3;
+		} break;
+		case YACE_OP_FX65:
+		{
+			if ((next[1] & 0xF000) == 0x7000 || (next[1] & 0xF000) == 0x8000)
+				op = YACE_OP_FX65_ALU, length = 2;
+		} break;
+		// Idle loops jumping back to this slot
+		case YACE_OP_1NNN:
+		{
+			if (inst->nnn == address)
+				op = YACE_OP_1NNN_SELF;
+		} break;
+		case YACE_OP_FX07:
+		{
+			if (next[2] != (0x1000 | address) || ((next[1] & 0x0F00) >> 8) != inst->x)
+				break;
+
+			if ((next[1] & 0xF000) == 0x3000)
+				op = YACE_OP_FX07_3XNN_1NNN, length = 3;
+			else if ((next[1] & 0xF000) == 0x4000)
+				op = YACE_OP_FX07_4XNN_1NNN, length = 3;
+		} break;
+		case YACE_OP_EX9E:
+		case YACE_OP_EXA1:
+		{
+			if (next[1] == (0x1000 | address))
+				op = op == YACE_OP_EX9E ? YACE_OP_EX9E_1NNN : YACE_OP_EXA1_1NNN, length = 2;
+		} break;
+	}
+
+	if (op == inst->op)
+		return;
+
+	for (i = 1; i < length; i++)
+	{
+		if (inst[i * 2].op == YACE_OP_Decode)
+			YACE_DecodeInstruction(&inst[i * 2], next[i]);
+	}
+
+	inst->op = op;
+	inst->handler = g_opHandlers[op];
+	inst->length = length;
+}
+
+// Returns the operation of the first instruction of a superinstruction,
+// the operation itself for the other ones. The slot holds its operands.
+int YACE_UnfusedOp(int op)
+{
+	switch (op)
+	{
+		case YACE_OP_ANNN_DXYN: return YACE_OP_ANNN;
+		case YACE_OP_6XNN_6XNN: return YACE_OP_6XNN;
+		case YACE_OP_7XNN_3XNN_1NNN:
+		case YACE_OP_7XNN_4XNN_1NNN: return YACE_OP_7XNN;
+		case YACE_OP_FX65_ALU: return YACE_OP_FX65;
+		case YACE_OP_1NNN_SELF: return YACE_OP_1NNN;
+		case YACE_OP_FX07_3XNN_1NNN:
+		case YACE_OP_FX07_4XNN_1NNN: return YACE_OP_FX07;
+		case YACE_OP_EX9E_1NNN: return YACE_OP_EX9E;
+		case YACE_OP_EXA1_1NNN: return YACE_OP_EXA1;
+	}
+
+	return op;
+}
+
+// Decodes the slot from the RAM
+void YACE_DecodeSlot(SCHIP8 *ctx, SYACEINST *inst)
+{
+	int address = YACE_CODE_START + (int)(inst - ctx->Engines->Code);
+
+	YACE_DecodeInstruction(inst, (ctx->RAM[address] << 8) | ctx->RAM[address + 1]);
+	YACE_FuseInstruction(ctx, inst);
+}
+
+// Handler of the slots not decoded yet
+int YACE_OpDecode(SCHIP8 *ctx, SYACEINST *inst)
+{
+	YACE_DecodeSlot(ctx, inst);
+	return inst->handler(ctx, inst);
+}
+
+// Returns the bytes of code of an operation which may stop the
+// engine on an idle loop, 0 for the other ones
+int YACE_IdleSize(int op)
+{
+	switch (op)
+	{
+		case YACE_OP_FX0A:
+		case YACE_OP_1NNN_SELF: return 2;
+		case YACE_OP_EX9E_1NNN:
+		case YACE_OP_EXA1_1NNN: return 4;
+		case YACE_OP_FX07_3XNN_1NNN:
+		case YACE_OP_FX07_4XNN_1NNN: return 6;
+	}
+
+	return 0;
+}
+
+// Runs the slot, PC already past it, when it may execute more
+// instructions than left: a superinstruction that doesn't fit
+// runs its first instruction only, so the budget is never exceeded
+int YACE_RunUnfused(SCHIP8 *ctx, SYACEINST *inst, int left)
+{
+	if (inst->op == YACE_OP_Decode)
+		YACE_DecodeSlot(ctx, inst);
+
+	if (inst->length > left)
+		return g_opHandlers[YACE_UnfusedOp(inst->op)](ctx, inst);
+
+	return inst->handler(ctx, inst);
+}
+
+// Executes the predecoded instruction at PC, no more than left
+// instructions, returns the number executed. The engines
+// translating code run idle loops and FX0A through it.
+int YACE_RunSlot(SCHIP8 *ctx, int left)
+{
+	SYACEINST *inst = &ctx->Engines->Code[ctx->PC - YACE_CODE_START];
+
+	ctx->PC += 2;
+	if (inst->length > left)
+		return YACE_RunUnfused(ctx, inst, left);
+
+	return inst->handler(ctx, inst);
+}
+
+// Allocates the engine state of the context, every slot to be
+// decoded. Returns NULL out of memory, the engines needing it
+// then fall back to the interpreter.
+SYACEENGINES *YACE_CreateEngines(SCHIP8 *ctx)
+{
+	if (!ctx->Engines && (ctx->Engines = (SYACEENGINES *)calloc(1, sizeof(SYACEENGINES))) != NULL)
+		YACE_FlushCode(ctx);
+
+	return ctx->Engines;
+}
+
+// Frees the engine state, the trace must be stopped first
+void YACE_FreeEngines(SCHIP8 *ctx)
+{
+	if (!ctx->Engines)
+		return;
+
+	YACE_FreeJit(ctx);
+	free(ctx->Engines);
+	ctx->Engines = NULL;
+}
+
+// Drops every predecoded instruction
+void YACE_FlushCode(SCHIP8 *ctx)
+{
+	int i;
+	SYACEENGINES *engines = ctx->Engines;
+
+#ifdef YACE_AOT
+	YACE_AotFlush(ctx);
+#endif
+
+	// Nothing was decoded yet
+	if (!engines)
+		return;
+
+	for (i = 0; i < YACE_CODE_SLOTS; i++)
+	{
+		engines->Code[i].handler = YACE_OpDecode;
+		engines->Code[i].op = YACE_OP_Decode;
+		engines->Code[i].length = YACE_MAX_FUSED;
+	}
+
+#ifdef YACE_HAS_JIT
+	if (engines->Jit)
+		YACE_JitFlush(engines->Jit);
+#endif
+}
+
+// Drops the instructions overlapping RAM[address..address+size-1]
+void YACE_InvalidateCode(SCHIP8 *ctx, int address, int size)
+{
+	int i;
+	SYACEENGINES *engines = ctx->Engines;
+	// The instructions starting up to a superinstruction before are touched as well
+	int first = address - (YACE_MAX_FUSED * 2 - 1) - YACE_CODE_START;
+	int last = address + size - YACE_CODE_START;
+
+#ifdef YACE_AOT
+	YACE_AotInvalidate(ctx, address, size);
+#endif
+
+	if (!engines)
+		return;
+
+	if (first < 0)
+		first = 0;
+	if (last > YACE_CODE_SLOTS)
+		last = YACE_CODE_SLOTS;
+
+	for (i = first; i < last; i++)
+	{
+		engines->Code[i].handler = YACE_OpDecode;
+		engines->Code[i].op = YACE_OP_Decode;
+		engines->Code[i].length = YACE_MAX_FUSED;
+	}
+
+#ifdef YACE_HAS_JIT
+	if (engines->Jit)
+		YACE_JitInvalidate(engines->Jit, address, size);
+#endif
+}
+
+// *******************************************************
+// Save states and rewind
+//
+// A snapshot is one copy of the guest state. The rewind history
+// keeps an entry a frame in a byte ring: the XOR of the state
+// with the one of the frame before, run-length encoded, so the
+// few bytes a frame changes take a few bytes. Every
+// YACE_REWIND_KEYFRAME frames the entry encodes the whole state
+// instead; a frame is rebuilt from the keyframe before it and
+// the deltas after that. When the ring is full the oldest
+// frames go, a keyframe and its deltas at a time.
+// *******************************************************
+
+// Frames between keyframes
+#define YACE_REWIND_KEYFRAME 120
+// Zero bytes worth ending a literal run for
+#define YACE_REWIND_MIN_ZEROS 3
+// Upper bound of an encoded entry
+#define YACE_REWIND_MAX_ENTRY (YACE_STATE_SIZE * 2 + 8)
+
+typedef struct _SYACEREWINDENTRY
+{
+	// Position and length in the byte ring
+	int offset;
+	int size;
+	// Set if it encodes the whole state, not the change from the frame before
+	int keyframe;
+} SYACEREWINDENTRY;
+
+struct _SYACEREWIND
+{
+	// Entries of the frames, the oldest at first
+	SYACEREWINDENTRY *entries;
+	int capacity;
+	int first;
+	int count;
+	// Encoded entries, each one contiguous
+	BYTE *ring;
+	int bytes;
+	// Deltas after the newest keyframe
+	int deltas;
+	// State of the newest frame
+	SYACESTATE last;
+	BYTE scratch[YACE_REWIND_MAX_ENTRY];
+};
+
+// The base of keyframes
+const SYACESTATE g_zeroState = { { 0 } };
+
+// Saves the guest state
+void YACE_SaveState(SCHIP8 *ctx, SYACESTATE *state)
+{
+	memcpy(state->data, ctx, YACE_STATE_SIZE);
+}
+
+// Restores the guest state. The instructions decoded from RAM that
+// changed are dropped and the screen rows that changed are marked
+// for the front end.
+void YACE_LoadState(SCHIP8 *ctx, const SYACESTATE *state)
+{
+	int i;
+	int first = -1;
+	const BYTE *ram = state->data + offsetof(SCHIP8, RAM);
+	const BYTE *video = state->data + offsetof(SCHIP8, Video);
+
+	// Compared a cache line at a time, neighbours changed are invalidated at once
+	for (i = YACE_CODE_START; i <= (int)sizeof(ctx->RAM); i += 64)
+	{
+		int changed = i < (int)sizeof(ctx->RAM) && memcmp(&ctx->RAM[i], &ram[i], 64);
+
+		if (changed && first < 0)
+			first = i;
+		else if (!changed && first >= 0)
+		{
+			YACE_InvalidateCode(ctx, first, i - first);
+			first = -1;
+		}
+	}
+
+	for (i = 0; i < YACE_VIDEO_HEIGHT; i++)
+	{
+		if (memcmp(&ctx->Video[i], video + i * sizeof(Uint64), sizeof(Uint64)))
+			ctx->dirtyRows |= 1u << i;
+	}
+
+	memcpy(ctx, state->data, YACE_STATE_SIZE);
+}
+
+// Writes a count of the encoding, 1 byte below 128, 2 otherwise
+BYTE *YACE_PutCount(BYTE *out, int count)
+{
+	if (count >= 0x80)
+		*out++ = 0x80 | (count >> 8);
+
+	*out++ = count & 0xFF;
+	return out;
+}
+
+const BYTE *YACE_GetCount(const BYTE *in, int *count)
+{
+	if (*in & 0x80)
+	{
+		*count = ((in[0] & 0x7F) << 8) | in[1];
+		return in + 2;
+	}
+
+	*count = *in;
+	return in + 1;
+}
+
+// Encodes the XOR of the states as runs: the count of zero bytes,
+// the count of literals, the literals. Returns the size.
+int YACE_EncodeDelta(BYTE *out, const BYTE *state, const BYTE *base)
+{
+	int i = 0;
+	BYTE *start = out;
+
+	for (;;)
+	{
+		int zeros = i;
+		int literals;
+
+		while (zeros < YACE_STATE_SIZE && state[zeros] == base[zeros])
+			zeros++;
+
+		// Trailing zeros aren't stored
+		if (zeros == YACE_STATE_SIZE)
+			break;
+
+		// Literals go on until enough zeros are worth a new run
+		for (literals = zeros + 1; literals < YACE_STATE_SIZE; literals++)
+		{
+			if (literals + YACE_REWIND_MIN_ZEROS <= YACE_STATE_SIZE &&
+				!memcmp(&state[literals], &base[literals], YACE_REWIND_MIN_ZEROS))
+				break;
+		}
+
+		out = YACE_PutCount(out, zeros - i);
+		out = YACE_PutCount(out, literals - zeros);
+
+		for (i = zeros; i < literals; i++)
+			*out++ = state[i] ^ base[i];
+	}
+
+	return (int)(out - start);
+}
+
+// XORs an encoded delta into the state
+void YACE_ApplyDelta(BYTE *state, const BYTE *in, int size)
+{
+	int i = 0;
+	const BYTE *end = in + size;
+
+	while (in < end)
+	{
+		int zeros, literals;
+
+		in = YACE_GetCount(in, &zeros);
+		in = YACE_GetCount(in, &literals);
+
+		for (i += zeros; literals > 0; literals--)
+			state[i++] ^= *in++;
+	}
+}
+
+// Creates a history of up to the given frames held in the given bytes
+SYACEREWIND *YACE_CreateRewind(int frames, int bytes)
+{
+	SYACEREWIND *rewind = (SYACEREWIND *)calloc(1, sizeof(SYACEREWIND));
+
+	if (!rewind)
+		return NULL;
+
+	rewind->capacity = frames;
+	rewind->bytes = bytes;
+	rewind->entries = (SYACEREWINDENTRY *)malloc(frames * sizeof(SYACEREWINDENTRY));
+	rewind->ring = (BYTE *)malloc(bytes);
+
+	if (!rewind->entries || !rewind->ring || bytes < YACE_REWIND_MAX_ENTRY)
+	{
+		YACE_FreeRewind(rewind);
+		return NULL;
+	}
+
+	return rewind;
+}
+
+void YACE_FreeRewind(SYACEREWIND *rewind)
+{
+	if (!rewind)
+		return;
+
+	free(rewind->entries);
+	free(rewind->ring);
+	free(rewind);
+}
+
+SYACEREWINDENTRY *YACE_RewindEntry(SYACEREWIND *rewind, int index)
+{
+	return &rewind->entries[(rewind->first + index) % rewind->capacity];
+}
+
+// Drops the oldest keyframe and its deltas
+void YACE_DropRewindGroup(SYACEREWIND *rewind)
+{
+	do
+	{
+		rewind->first = (rewind->first + 1) % rewind->capacity;
+		rewind->count--;
+	} while (rewind->count && !YACE_RewindEntry(rewind, 0)->keyframe);
+}
+
+// Adds the state of the frame just run to the history
+void YACE_PushRewind(SYACEREWIND *rewind, SCHIP8 *ctx)
+{
+	SYACEREWINDENTRY *entry;
+	int keyframe = !rewind->count || rewind->deltas + 1 >= YACE_REWIND_KEYFRAME;
+	int offset, size;
+
+	for (;;)
+	{
+		SYACEREWINDENTRY *newest;
+
+		size = YACE_EncodeDelta(rewind->scratch, (const BYTE *)ctx,
+			keyframe ? g_zeroState.data : rewind->last.data);
+
+		if (rewind->count == rewind->capacity)
+			YACE_DropRewindGroup(rewind);
+
+		// Entries are contiguous, the end of the ring is skipped if too short
+		newest = rewind->count ? YACE_RewindEntry(rewind, rewind->count - 1) : NULL;
+		offset = newest ? newest->offset + newest->size : 0;
+		if (offset + size > rewind->bytes)
+		{
+			// The frames left past the newest are the oldest ones
+			while (rewind->count && YACE_RewindEntry(rewind, 0)->offset >= offset)
+				YACE_DropRewindGroup(rewind);
+
+			offset = 0;
+		}
+
+		// Make room from the oldest frames
+		while (rewind->count)
+		{
+			SYACEREWINDENTRY *oldest = YACE_RewindEntry(rewind, 0);
+
+			if (oldest->offset >= offset + size || oldest->offset + oldest->size <= offset)
+				break;
+
+			YACE_DropRewindGroup(rewind);
+		}
+
+		// A delta needs the frames before it
+		if (keyframe || rewind->count)
+			break;
+
+		keyframe = 1;
+	}
+
+	memcpy(&rewind->ring[offset], rewind->scratch, size);
+	entry = YACE_RewindEntry(rewind, rewind->count++);
+	entry->offset = offset;
+	entry->size = size;
+	entry->keyframe = keyframe;
+
+	rewind->deltas = keyframe ? 0 : rewind->deltas + 1;
+	YACE_SaveState(ctx, &rewind->last);
+}
+
+// Goes back to the frame before the newest one, returns 0 if the
+// history doesn't hold it
+int YACE_StepRewind(SYACEREWIND *rewind, SCHIP8 *ctx)
+{
+	int i, key;
+
+	if (rewind->count < 2)
+		return 0;
+
+	rewind->count--;
+
+	for (key = rewind->count - 1; !YACE_RewindEntry(rewind, key)->keyframe; key--);
+
+	memset(&rewind->last, 0, sizeof(rewind->last));
+
+	for (i = key; i < rewind->count; i++)
+	{
+		SYACEREWINDENTRY *entry = YACE_RewindEntry(rewind, i);
+
+		YACE_ApplyDelta(rewind->last.data, &rewind->ring[entry->offset], entry->size);
+	}
+
+	rewind->deltas = rewind->count - 1 - key;
+	YACE_LoadState(ctx, &rewind->last);
+	return 1;
+}
+
+// *******************************************************
+// Execution engines
+// *******************************************************
+
+// Reference engine: fetch and decode every opcode
+int YACE_RunInterpreter(SCHIP8 *ctx, int cycles)
+{
+	int i;
+
+	for (i = 0; i < cycles; i++)
+		YACE_ExecuteOpcode(ctx, YACE_FetchOpcode(ctx));
+
+	return i;
+}
+
+// Predecoded engine
+int YACE_RunCached(SCHIP8 *ctx, int cycles)
+{
+	int done = 0;
+
+	while (done < cycles)
+	{
+		WORD pc = ctx->PC;
+
+		// The last address can't hold a whole opcode
+		if ((unsigned int)(pc - YACE_CODE_START) < YACE_CODE_SLOTS - 1)
+		{
+			SYACEINST *inst = &ctx->Engines->Code[pc - YACE_CODE_START];
+
+			ctx->PC = pc + 2;
+			if (inst->length > cycles - done)
+				done += YACE_RunUnfused(ctx, inst, cycles - done);
+			else
+				done += inst->handler(ctx, inst);
+		}
+		else
+		{
+			YACE_ExecuteOpcode(ctx, YACE_FetchOpcode(ctx));
+			done++;
+		}
+	}
+
+	return done;
+}
+
+// *******************************************************
+// Profile engine
+//
+// Runs the reference interpreter counting the pairs and
+// triples of operations executed one after the other from
+// consecutive addresses, the candidates for the superinstructions
+// of YACE_FuseInstruction. The most frequent ones are printed
+// on exit.
+// *******************************************************
+#define YACE_PROFILE_TOP 16
+
+typedef struct _SYACEPROFILE
+{
+	Uint64 pairs[YACE_OP_COUNT][YACE_OP_COUNT];
+	Uint64 triples[YACE_OP_COUNT][YACE_OP_COUNT][YACE_OP_COUNT];
+	// Operations and address of the current straight-line chain
+	int prev[2];
+	int length;
+	WORD next;
+} SYACEPROFILE;
+
+typedef struct _SYACESEQUENCE
+{
+	Uint64 count;
+	int ops[3];
+} SYACESEQUENCE;
+
+SYACEPROFILE *g_profile = NULL;
+
+// Sorts sequences from the most executed
+int YACE_CompareSequences(const void *a, const void *b)
+{
+	Uint64 first = ((const SYACESEQUENCE *)a)->count;
+	Uint64 second = ((const SYACESEQUENCE *)b)->count;
+
+	return (first < second) - (first > second);
+}
+
+// Prints the most executed sequences of the given length
+void YACE_PrintSequences(Uint64 *counts, int length)
+{
+	int i, j;
+	int total = length == 2 ? YACE_OP_COUNT * YACE_OP_COUNT : YACE_OP_COUNT * YACE_OP_COUNT * YACE_OP_COUNT;
+	SYACESEQUENCE *sequences = (SYACESEQUENCE *)malloc(total * sizeof(SYACESEQUENCE));
+
+	if (!sequences)
+		return;
+
+	for (i = 0; i < total; i++)
+	{
+		int index = i;
+
+		sequences[i].count = counts[i];
+		for (j = length - 1; j >= 0; j--)
+		{
+			sequences[i].ops[j] = index % YACE_OP_COUNT;
+			index /= YACE_OP_COUNT;
+		}
+	}
+
+	qsort(sequences, total, sizeof(SYACESEQUENCE), YACE_CompareSequences);
+	printf("Most executed %s:\n", length == 2 ? "pairs" : "triples");
+
+	for (i = 0; i < YACE_PROFILE_TOP && sequences[i].count; i++)
+	{
+		printf("%12llu ", (unsigned long long)sequences[i].count);
+		for (j = 0; j < length; j++)
+			printf(" %s", g_opNames[sequences[i].ops[j]]);
+		printf("\n");
+	}
+
+	free(sequences);
+}
+
+// Prints the profile, registered with atexit
+void YACE_PrintProfile(void)
+{
+	if (!g_profile)
+		return;
+
+	YACE_PrintSequences(&g_profile->pairs[0][0], 2);
+	YACE_PrintSequences(&g_profile->triples[0][0][0], 3);
+	free(g_profile);
+	g_profile = NULL;
+}
+
+int YACE_RunProfile(SCHIP8 *ctx, int cycles)
+{
+	int i;
+	SYACEPROFILE *profile = g_profile;
+
+	if (!profile)
+	{
+		profile = g_profile = (SYACEPROFILE *)calloc(1, sizeof(SYACEPROFILE));
+		if (!profile)
+			return YACE_RunInterpreter(ctx, cycles);
+		atexit(YACE_PrintProfile);
+	}
+
+	for (i = 0; i < cycles; i++)
+	{
+		SYACEINST inst;
+		WORD opcode = YACE_FetchOpcode(ctx);
+
+		// Jumps, calls and skips start a new chain
+		if (ctx->PC != profile->next)
+			profile->length = 0;
+
+		YACE_DecodeInstruction(&inst, opcode);
+		if (profile->length >= 1)
+			profile->pairs[profile->prev[1]][inst.op]++;
+		if (profile->length >= 2)
+			profile->triples[profile->prev[0]][profile->prev[1]][inst.op]++;
+
+		profile->prev[0] = profile->prev[1];
+		profile->prev[1] = inst.op;
+		profile->length++;
+		profile->next = ctx->PC + 2;
+
+		YACE_ExecuteOpcode(ctx, opcode);
+	}
+
+	return i;
+}
+
+// *******************************************************
+// Threaded engines
+//
+// They run the predecoded slots without the central loop of
+// YACE_RunCached: every operation ends jumping straight to the
+// next one, so each has its own indirect branch for the
+// predictor. The first uses computed gotos (GCC and Clang),
+// the second chains handlers with guaranteed tail calls, or
+// returns to a trampoline when the compiler can't promise them.
+// *******************************************************
+#ifdef YACE_HAS_THREADED
+
+#define YACE_OP_LABEL(name) &&op_##name,
+#define YACE_OP_CASE(name) op_##name: done += YACE_Op##name(ctx, inst); YACE_THREADED_NEXT();
+
+// Jumps to the operation at PC, running the interpreter out of the slots
+#define YACE_THREADED_NEXT() \
+	do { \
+		if (done >= cycles) \
+			return done; \
+		slot = ctx->PC - YACE_CODE_START; \
+		if (slot >= YACE_CODE_SLOTS - 1) \
+			goto outside; \
+		inst = &ctx->Engines->Code[slot]; \
+		ctx->PC += 2; \
+		if (inst->length > cycles - done) \
+			goto unfused; \
+		goto *labels[inst->op]; \
+	} while (0)
+
+int YACE_RunThreaded(SCHIP8 *ctx, int cycles)
+{
+	static void *labels[YACE_OP_COUNT] =
+	{
+		&&op_Decode,
+		YACE_FOREACH_OP(YACE_OP_LABEL)
+	};
+	int done = 0;
+	unsigned int slot;
+	SYACEINST *inst;
+
+	YACE_THREADED_NEXT();
+
+op_Decode:
+	YACE_DecodeSlot(ctx, inst);
+	goto *labels[inst->op];
+
+outside:
+	YACE_ExecuteOpcode(ctx, YACE_FetchOpcode(ctx));
+	done++;
+	YACE_THREADED_NEXT();
+
+unfused:
+	done += YACE_RunUnfused(ctx, inst, cycles - done);
+	YACE_THREADED_NEXT();
+
+	YACE_FOREACH_OP(YACE_OP_CASE)
+}
+
+#endif // YACE_HAS_THREADED
+
+typedef int (*YACE_TAILHANDLER)(SCHIP8 *ctx, SYACEINST *inst, int left);
+
+#ifdef YACE_MUSTTAIL
+#define YACE_TAIL_CALL(handler, ctx, inst, left) YACE_MUSTTAIL return handler(ctx, inst, left)
+#define YACE_TAIL_NEXT(ctx, inst, left) YACE_TAIL_CALL(YACE_TailDispatch, ctx, inst, left)
+#else
+// Back to YACE_RunTailCall, which dispatches the next operation
+#define YACE_TAIL_CALL(handler, ctx, inst, left) return handler(ctx, inst, left)
+#define YACE_TAIL_NEXT(ctx, inst, left) return left
+#endif
+
+int YACE_TailDispatch(SCHIP8 *ctx, SYACEINST *inst, int left);
+int YACE_TailDecode(SCHIP8 *ctx, SYACEINST *inst, int left);
+
+#define YACE_OP_TAILPROTO(name) int YACE_Tail##name(SCHIP8 *ctx, SYACEINST *inst, int left);
+#define YACE_OP_TAILHANDLER(name) YACE_Tail##name,
+#define YACE_OP_TAIL(name) \
+	int YACE_Tail##name(SCHIP8 *ctx, SYACEINST *inst, int left) \
+	{ \
+		left -= YACE_Op##name(ctx, inst); \
+		YACE_TAIL_NEXT(ctx, inst, left); \
+	}
+
+YACE_FOREACH_OP(YACE_OP_TAILPROTO)
+
+// Tail call handlers, indexed by YACE_OP_*
+YACE_TAILHANDLER g_tailHandlers[YACE_OP_COUNT] =
+{
+	YACE_TailDecode,
+	YACE_FOREACH_OP(YACE_OP_TAILHANDLER)
+};
+
+YACE_FOREACH_OP(YACE_OP_TAIL)
+
+// Runs the operation at PC, left is the number of instructions still to run
+int YACE_TailDispatch(SCHIP8 *ctx, SYACEINST *inst, int left)
+{
+	unsigned int slot = ctx->PC - YACE_CODE_START;
+
+	if (left <= 0)
+		return left;
+
+	if (slot >= YACE_CODE_SLOTS - 1)
+	{
+		YACE_ExecuteOpcode(ctx, YACE_FetchOpcode(ctx));
+		YACE_TAIL_NEXT(ctx, inst, left - 1);
+	}
+
+	inst = &ctx->Engines->Code[slot];
+	ctx->PC += 2;
+
+	if (inst->length > left)
+		YACE_TAIL_NEXT(ctx, inst, left - YACE_RunUnfused(ctx, inst, left));
+
+	YACE_TAIL_CALL(g_tailHandlers[inst->op], ctx, inst, left);
+}
+
+int YACE_TailDecode(SCHIP8 *ctx, SYACEINST *inst, int left)
+{
+	YACE_DecodeSlot(ctx, inst);
+	YACE_TAIL_CALL(g_tailHandlers[inst->op], ctx, inst, left);
+}
+
+int YACE_RunTailCall(SCHIP8 *ctx, int cycles)
+{
+	int left = cycles;
+
+	// With guaranteed tail calls this returns once the budget is over
+	while (left > 0)
+		left = YACE_TailDispatch(ctx, NULL, left);
+
+	return cycles - left;
+}
+
+// *******************************************************
+// x86-64 dynamic recompiler
+//
+// Guest basic blocks, ending on jumps, calls, returns and
+// skips, are translated into native functions working on the
+// SCHIP8 structure (kept in RBX) and returning the number of
+// instructions executed. The budget left, kept in R12, is
+// checked before every instruction past the first: a block
+// stops there, with PC set, once it's spent. Simple opcodes
+// are inlined, the other ones call the reference interpreter.
+// FX33 and FX55 end the block as well, so a block writing over
+// translated code never runs the stale instructions.
+// *******************************************************
+#ifdef YACE_HAS_JIT
+
+#define YACE_JIT_CODE_SIZE (1024 * 1024)
+#define YACE_JIT_BLOCK_LENGTH 64
+// Largest native code of a block (a call-out and a budget check
+// are the longest sequence)
+#define YACE_JIT_BLOCK_SIZE (YACE_JIT_BLOCK_LENGTH * 80 + 64)
+
+typedef int (*YACE_JITBLOCK)(SCHIP8 *ctx, int budget);
+typedef void (*YACE_OPCODEHANDLER)(SCHIP8 *ctx, WORD opcode);
+
+// **********************************
+// Recompiler state of a context
+// **********************************
+struct _SYACEJIT
+{
+	// Code memory and the bytes used, writable only while
+	// a block is translated and executable the rest of the time
+	BYTE *code;
+	int used;
+	// Translated block starting at each address from 0x200
+	YACE_JITBLOCK block[YACE_CODE_SLOTS];
+	// Bytes of guest code of each block
+	WORD length[YACE_CODE_SLOTS];
+	// Number of blocks covering each address
+	BYTE covered[YACE_CODE_SLOTS];
+};
+
+// x86 registers used as ModRM reg field
+#define YACE_X86_EAX 0
+#define YACE_X86_CMP 7
+
+void YACE_JitByte(SYACEJIT *jit, int value)
+{
+	jit->code[jit->used++] = value;
+}
+
+void YACE_JitWord(SYACEJIT *jit, int value)
+{
+	YACE_JitByte(jit, value & 0xFF);
+	YACE_JitByte(jit, (value >> 8) & 0xFF);
+}
+
+void YACE_JitDword(SYACEJIT *jit, Uint32 value)
+{
+	YACE_JitWord(jit, value & 0xFFFF);
+	YACE_JitWord(jit, value >> 16);
+}
+
+void YACE_JitQword(SYACEJIT *jit, Uint64 value)
+{
+	YACE_JitDword(jit, (Uint32)value);
+	YACE_JitDword(jit, (Uint32)(value >> 32));
+}
+
+// Emits [prefix] opcode with a [rbx + offset] operand
+void YACE_JitMem(SYACEJIT *jit, int prefix, int opcode, int reg, int offset)
+{
+	if (prefix)
+		YACE_JitByte(jit, prefix);
+	if (opcode > 0xFF)
+		YACE_JitByte(jit, opcode >> 8);
+
+	YACE_JitByte(jit, opcode & 0xFF);
+	// mod = 10 (disp32), rm = 011 (rbx)
+	YACE_JitByte(jit, 0x80 | (reg << 3) | 3);
+	YACE_JitDword(jit, offset);
+}
+
+// mov byte [rbx + offset], value
+void YACE_JitStoreByte(SYACEJIT *jit, int offset, int value)
+{
+	YACE_JitMem(jit, 0, 0xC6, 0, offset);
+	YACE_JitByte(jit, value);
+}
+
+// mov word [rbx + offset], value
+void YACE_JitStoreWord(SYACEJIT *jit, int offset, int value)
+{
+	YACE_JitMem(jit, 0x66, 0xC7, 0, offset);
+	YACE_JitWord(jit, value);
+}
+
+// Sets PC, then skips the next instruction when the flags
+// of the previous compare satisfy the given jcc (0x74 je, 0x75 jne)
+void YACE_JitSkip(SYACEJIT *jit, int jcc, int pc)
+{
+	YACE_JitStoreWord(jit, offsetof(SCHIP8, PC), pc);
+	YACE_JitByte(jit, jcc);
+	// Size of the following store
+	YACE_JitByte(jit, 9);
+	YACE_JitStoreWord(jit, offsetof(SCHIP8, PC), pc + 2);
+}
+
+// Restores the stack and the saved registers, then returns eax
+void YACE_JitReturn(SYACEJIT *jit)
+{
+#ifdef _WIN32
+	// add rsp, 40 (shadow space and alignment)
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x83); YACE_JitByte(jit, 0xC4); YACE_JitByte(jit, 0x28);
+#else
+	// add rsp, 8 (alignment)
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x83); YACE_JitByte(jit, 0xC4); YACE_JitByte(jit, 0x08);
+#endif
+	// pop r12; pop rbx; ret
+	YACE_JitByte(jit, 0x41); YACE_JitByte(jit, 0x5C);
+	YACE_JitByte(jit, 0x5B);
+	YACE_JitByte(jit, 0xC3);
+}
+
+// Returns count, with PC at the given address, when the budget
+// is no more than the instructions already run
+void YACE_JitCheckBudget(SYACEJIT *jit, int count, int pc)
+{
+	// cmp r12d, count; jg over the exit
+	YACE_JitByte(jit, 0x41); YACE_JitByte(jit, 0x83); YACE_JitByte(jit, 0xFC); YACE_JitByte(jit, count);
+	YACE_JitByte(jit, 0x7F);
+	// Size of the store, the mov and the return
+	YACE_JitByte(jit, 9 + 5 + 8);
+	YACE_JitStoreWord(jit, offsetof(SCHIP8, PC), pc);
+	// mov eax, count
+	YACE_JitByte(jit, 0xB8);
+	YACE_JitDword(jit, count);
+	YACE_JitReturn(jit);
+}
+
+// mov rax, address; call rax
+void YACE_JitCallAddress(SYACEJIT *jit, Uint64 address)
+{
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0xB8);
+	YACE_JitQword(jit, address);
+	YACE_JitByte(jit, 0xFF); YACE_JitByte(jit, 0xD0);
+}
+
+// Calls handler(ctx, opcode)
+void YACE_JitCall(SYACEJIT *jit, YACE_OPCODEHANDLER handler, WORD opcode)
+{
+#ifdef _WIN32
+	// mov rcx, rbx; mov edx, opcode
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xD9);
+	YACE_JitByte(jit, 0xBA); YACE_JitDword(jit, opcode);
+#else
+	// mov rdi, rbx; mov esi, opcode
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xDF);
+	YACE_JitByte(jit, 0xBE); YACE_JitDword(jit, opcode);
+#endif
+	YACE_JitCallAddress(jit, (Uint64)(size_t)handler);
+}
+
+// Calls YACE_RunSlot(ctx, budget), leaving its count in eax
+void YACE_JitCallSlot(SYACEJIT *jit)
+{
+#ifdef _WIN32
+	// mov rcx, rbx; mov edx, r12d
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xD9);
+	YACE_JitByte(jit, 0x44); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xE2);
+#else
+	// mov rdi, rbx; mov esi, r12d
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xDF);
+	YACE_JitByte(jit, 0x44); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xE6);
+#endif
+	YACE_JitCallAddress(jit, (Uint64)(size_t)YACE_RunSlot);
+}
+
+// Reference handler of an opcode, skipping the first switch
+YACE_OPCODEHANDLER YACE_JitHandler(WORD opcode)
+{
+	switch (opcode & 0xF000)
+	{
+		case 0x0000: return YACE_Decode0NNNOpcode;
+		case 0x1000: return YACE_Execute1NNNOpcode;
+		case 0x2000: return YACE_Execute2NNNOpcode;
+		case 0x3000: return YACE_Execute3XNNOpcode;
+		case 0x4000: return YACE_Execute4XNNOpcode;
+		case 0x5000: return YACE_Execute5XY0Opcode;
+		case 0x6000: return YACE_Execute6XNNOpcode;
+		case 0x7000: return YACE_Execute7XNNOpcode;
+		case 0x8000: return YACE_Decode8XYNOpcode;
+		case 0x9000: return YACE_Execute9XY0Opcode;
+		case 0xA000: return YACE_ExecuteANNNOpcode;
+		case 0xB000: return YACE_ExecuteBNNNOpcode;
+		case 0xC000: return YACE_ExecuteCXNNOpcode;
+		case 0xD000: return YACE_ExecuteDXYNOpcode;
+		case 0xE000: return YACE_DecodeEXNNOpcode;
+		default: return YACE_DecodeFXNNOpcode;
+	}
+}
+
+// Returns 1 if the opcode changes PC or may write over code
+int YACE_JitEndsBlock(WORD opcode)
+{
+	switch (opcode & 0xF000)
+	{
+		case 0x0000: return (opcode & 0xF) == 0xE;
+		case 0x1000:
+		case 0x2000:
+		case 0x3000:
+		case 0x4000:
+		case 0x5000:
+		case 0x9000:
+		case 0xB000:
+		case 0xE000: return 1;
+		case 0xF000:
+		{
+			switch (opcode & 0x00FF)
+			{
+				case 0x0A:
+				case 0x33:
+				case 0x55: return 1;
+			}
+		} break;
+	}
+
+	return 0;
+}
+
+// Makes the code memory writable, or executable again: it's never
+// both at once (W^X). Returns 0 if the host refused
+int YACE_JitProtect(SYACEJIT *jit, int writable)
+{
+#ifdef _WIN32
+	DWORD old;
+
+	return VirtualProtect(jit->code, YACE_JIT_CODE_SIZE,
+		writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old) != 0;
+#else
+	return !mprotect(jit->code, YACE_JIT_CODE_SIZE,
+		writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+#endif
+}
+
+// Drops every translated block
+void YACE_JitFlush(SYACEJIT *jit)
+{
+	jit->used = 0;
+	memset(jit->block, 0, sizeof(jit->block));
+	memset(jit->covered, 0, sizeof(jit->covered));
+}
+
+// Drops the blocks overlapping RAM[address..address+size-1]
+void YACE_JitInvalidate(SYACEJIT *jit, int address, int size)
+{
+	int i, j;
+	int first = address - YACE_CODE_START;
+	int last = first + size;
+
+	if (first < 0)
+		first = 0;
+	if (last > YACE_CODE_SLOTS)
+		last = YACE_CODE_SLOTS;
+
+	for (i = first; i < last; i++)
+	{
+		if (jit->covered[i])
+			break;
+	}
+
+	if (i == last)
+		return;
+
+	// Blocks are at most YACE_JIT_BLOCK_LENGTH opcodes long
+	for (i = first - YACE_JIT_BLOCK_LENGTH * 2; i < last; i++)
+	{
+		if (i < 0 || !jit->block[i] || i + jit->length[i] <= first)
+			continue;
+
+		for (j = 0; j < jit->length[i]; j++)
+			jit->covered[i + j]--;
+
+		jit->block[i] = NULL;
+	}
+}
+
+// Translates the block starting at the given slot, NULL if
+// the code memory can't be switched between write and execute
+YACE_JITBLOCK YACE_JitTranslate(SCHIP8 *ctx, SYACEJIT *jit, int slot)
+{
+	int i;
+	int count = 0;
+	int done = 0;
+	int pc = YACE_CODE_START + slot;
+	BYTE *entry;
+	SYACEINST *inst;
+
+	if (jit->used + YACE_JIT_BLOCK_SIZE > YACE_JIT_CODE_SIZE)
+		YACE_JitFlush(jit);
+
+	if (!YACE_JitProtect(jit, 1))
+		return NULL;
+
+	entry = jit->code + jit->used;
+	inst = &ctx->Engines->Code[slot];
+
+	if (inst->op == YACE_OP_Decode)
+		YACE_DecodeSlot(ctx, inst);
+
+	// push rbx; push r12
+	YACE_JitByte(jit, 0x53);
+	YACE_JitByte(jit, 0x41); YACE_JitByte(jit, 0x54);
+#ifdef _WIN32
+	// mov rbx, rcx; mov r12d, edx; sub rsp, 40 (shadow space and alignment)
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xCB);
+	YACE_JitByte(jit, 0x41); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xD4);
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x83); YACE_JitByte(jit, 0xEC); YACE_JitByte(jit, 0x28);
+#else
+	// mov rbx, rdi; mov r12d, esi; sub rsp, 8 (alignment)
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xFB);
+	YACE_JitByte(jit, 0x41); YACE_JitByte(jit, 0x89); YACE_JitByte(jit, 0xF4);
+	YACE_JitByte(jit, 0x48); YACE_JitByte(jit, 0x83); YACE_JitByte(jit, 0xEC); YACE_JitByte(jit, 0x08);
+#endif
+
+	// Idle loops and FX0A run through the predecoded handlers, which
+	// stop the engine when the guest waits: the block returns their count
+	if (YACE_IdleSize(inst->op))
+	{
+		YACE_JitStoreWord(jit, offsetof(SCHIP8, PC), pc);
+		YACE_JitCallSlot(jit);
+		pc += YACE_IdleSize(inst->op);
+		done = 1;
+	}
+
+	while (!done)
+	{
+		WORD opcode = (ctx->RAM[pc] << 8) | ctx->RAM[pc + 1];
+		int vx = offsetof(SCHIP8, V) + ((opcode & 0x0F00) >> 8);
+		int vy = offsetof(SCHIP8, V) + ((opcode & 0x00F0) >> 4);
+
+		// The block is entered with some budget, the first always runs
+		if (count)
+			YACE_JitCheckBudget(jit, count, pc);
+
+		pc += 2;
+		count++;
+
+		switch (opcode & 0xF000)
+		{
+			// Jumps to address NNN.
+			case 0x1000:
+				YACE_JitStoreWord(jit, offsetof(SCHIP8, PC), opcode & 0x0FFF);
+				done = 1;
+				break;
+			// Skips the next instruction if VX equals (3XNN) or doesn't equal (4XNN) NN.
+			case 0x3000:
+			case 0x4000:
+				YACE_JitMem(jit, 0, 0x80, YACE_X86_CMP, vx);
+				YACE_JitByte(jit, opcode & 0x00FF);
+				YACE_JitSkip(jit, (opcode & 0xF000) == 0x3000 ? 0x75 : 0x74, pc);
+				done = 1;
+				break;
+			// Skips the next instruction if VX equals (5XY0) or doesn't equal (9XY0) VY.
+			case 0x5000:
+			case 0x9000:
+				YACE_JitMem(jit, 0, 0x0FB6, YACE_X86_EAX, vx);
+				YACE_JitMem(jit, 0, 0x3A, YACE_X86_EAX, vy);
+				YACE_JitSkip(jit, (opcode & 0xF000) == 0x5000 ? 0x75 : 0x74, pc);
+				done = 1;
+				break;
+			// Sets VX to NN.
+			case 0x6000:
+				YACE_JitStoreByte(jit, vx, opcode & 0x00FF);
+				break;
+			// Adds NN to VX.
+			case 0x7000:
+				YACE_JitMem(jit, 0, 0x80, 0, vx);
+				YACE_JitByte(jit, opcode & 0x00FF);
+				break;
+			// Sets I to the address NNN.
+			case 0xA000:
+				YACE_JitStoreWord(jit, offsetof(SCHIP8, I), opcode & 0x0FFF);
+				break;
+			default:
+			{
+				// 8XY0-8XY3: mov, or, and, xor
+				static const int alu[4] = { 0x88, 0x08, 0x20, 0x30 };
+
+				if ((opcode & 0xF000) == 0x8000 && (opcode & 0x000F) < 4)
+				{
+					YACE_JitMem(jit, 0, 0x0FB6, YACE_X86_EAX, vy);
+					YACE_JitMem(jit, 0, alu[opcode & 0x000F], YACE_X86_EAX, vx);
+				}
+				else if ((opcode & 0xF000) == 0x0000 && (opcode & 0xF) != 0x0 && (opcode & 0xF) != 0xE)
+				{
+					// 0NNN does nothing
+				}
+				else
+				{
+					done = YACE_JitEndsBlock(opcode);
+
+					// The handler may look at PC
+					if (done)
+						YACE_JitStoreWord(jit, offsetof(SCHIP8, PC), pc);
+
+					YACE_JitCall(jit, YACE_JitHandler(opcode), opcode);
+				}
+			} break;
+		}
+
+		// Stop at the end of the RAM or when the block is too long
+		if (!done && (count == YACE_JIT_BLOCK_LENGTH || pc > 0xFFE))
+		{
+			YACE_JitStoreWord(jit, offsetof(SCHIP8, PC), pc);
+			done = 1;
+		}
+	}
+
+	// mov eax, count
+	if (count)
+	{
+		YACE_JitByte(jit, 0xB8);
+		YACE_JitDword(jit, count);
+	}
+
+	YACE_JitReturn(jit);
+
+	if (!YACE_JitProtect(jit, 0))
+		return NULL;
+
+	jit->block[slot] = (YACE_JITBLOCK)entry;
+	jit->length[slot] = pc - (YACE_CODE_START + slot);
+
+	for (i = 0; i < jit->length[slot]; i++)
+		jit->covered[slot + i]++;
+
+	return jit->block[slot];
+}
+
+// Allocates the recompiler of the context, NULL if there's no executable memory
+SYACEJIT *YACE_CreateJit(SCHIP8 *ctx)
+{
+	SYACEJIT *jit = (SYACEJIT *)calloc(1, sizeof(SYACEJIT));
+
+	if (!jit)
+		return NULL;
+
+#ifdef _WIN32
+	jit->code = (BYTE *)VirtualAlloc(NULL, YACE_JIT_CODE_SIZE,
+		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	jit->code = (BYTE *)mmap(NULL, YACE_JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (jit->code == MAP_FAILED)
+		jit->code = NULL;
+#endif
+
+	if (!jit->code)
+	{
+		free(jit);
+		return NULL;
+	}
+
+	ctx->Engines->Jit = jit;
+	return jit;
+}
+
+void YACE_FreeJit(SCHIP8 *ctx)
+{
+	SYACEJIT *jit = ctx->Engines ? ctx->Engines->Jit : NULL;
+
+	if (!jit)
+		return;
+
+#ifdef _WIN32
+	VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+	munmap(jit->code, YACE_JIT_CODE_SIZE);
+#endif
+
+	free(jit);
+	ctx->Engines->Jit = NULL;
+}
+
+// Recompiler engine, falls back to the predecoded one without executable memory
+int YACE_RunJit(SCHIP8 *ctx, int cycles)
+{
+	int done = 0;
+	SYACEJIT *jit = ctx->Engines->Jit;
+
+	if (!jit && !(jit = YACE_CreateJit(ctx)))
+	{
+		printf("YACE: no memory for the JIT, running the cached engine\n");
+		ctx->engine = YACE_ENGINE_CACHED;
+		return YACE_RunCached(ctx, cycles);
+	}
+
+	while (done < cycles)
+	{
+		unsigned int slot = ctx->PC - YACE_CODE_START;
+
+		if (slot < YACE_CODE_SLOTS - 1)
+		{
+			YACE_JITBLOCK block = jit->block[slot];
+
+			if (!block && !(block = YACE_JitTranslate(ctx, jit, slot)))
+			{
+				printf("YACE: the JIT code can't be made executable, running the cached engine\n");
+				ctx->engine = YACE_ENGINE_CACHED;
+				return done + YACE_RunCached(ctx, cycles - done);
+			}
+
+			done += block(ctx, cycles - done);
+		}
+		else
+		{
+			YACE_ExecuteOpcode(ctx, YACE_FetchOpcode(ctx));
+			done++;
+		}
+	}
+
+	return done;
+}
+
+#else
+
+void YACE_FreeJit(SCHIP8 *ctx)
+{
+}
+
+#endif // YACE_HAS_JIT
+
+#ifdef YACE_TRACE
+
+// *******************************************************
+// Execution trace
+//
+// While enabled, the reference interpreter runs in place of
+// the engine and writes a fixed-size record of every
+// instruction into a ring owned by the context. A thread
+// drains the ring into the file, so the emulation never waits
+// on the disk or formats text. The file starts with the magic,
+// then 8 bytes for each instruction, little endian:
+//
+//   PC, opcode, I after it (16 bits each), VX and VF after it
+//
+// A record with PC 0xFFFF stands for the instructions run while
+// the ring was full, opcode and I hold the low and high 16 bits
+// of their number. tools/yace_trace.c prints a trace.
+// *******************************************************
+
+#define YACE_TRACE_MAGIC "YACETRC1"
+// Records the ring holds, a power of 2
+#define YACE_TRACE_RECORDS (1 << 16)
+// Records the drain thread writes at once
+#define YACE_TRACE_CHUNK 1024
+#define YACE_TRACE_GAP 0xFFFF
+
+typedef struct _SYACETRACERECORD
+{
+	WORD pc;
+	WORD opcode;
+	WORD I;
+	BYTE vx;
+	BYTE vf;
+} SYACETRACERECORD;
+
+struct _SYACETRACE
+{
+	SYACETRACERECORD ring[YACE_TRACE_RECORDS];
+	// Records written, published by the emulation thread after each run
+	SDL_atomic_t head;
+	// Records in the file, published by the drain thread
+	SDL_atomic_t tail;
+	// Instructions run while the ring was full, not marked yet
+	Uint32 lost;
+	// Recording, the trace stays open while it's off
+	int enabled;
+	// Cleared to stop the drain thread once the ring is empty
+	SDL_atomic_t draining;
+	// Posted for new records or the stop, the drain thread waits on it
+	SDL_sem *filled;
+	SDL_Thread *thread;
+	FILE *file;
+};
+
+// Reference engine writing a record of every instruction
+int YACE_RunTraced(SCHIP8 *ctx, int cycles)
+{
+	int i;
+	SYACETRACE *trace = ctx->Engines->Trace;
+	Uint32 head = (Uint32)SDL_AtomicGet(&trace->head);
+	Uint32 room = YACE_TRACE_RECORDS - (head - (Uint32)SDL_AtomicGet(&trace->tail));
+
+	if (trace->lost && room)
+	{
+		SYACETRACERECORD *gap = &trace->ring[head++ & (YACE_TRACE_RECORDS - 1)];
+
+		gap->pc = YACE_TRACE_GAP;
+		gap->opcode = (WORD)trace->lost;
+		gap->I = (WORD)(trace->lost >> 16);
+		gap->vx = gap->vf = 0;
+		trace->lost = 0;
+		room--;
+	}
+
+	for (i = 0; i < cycles; i++)
+	{
+		WORD pc = ctx->PC;
+		WORD opcode = YACE_FetchOpcode(ctx);
+
+		YACE_ExecuteOpcode(ctx, opcode);
+
+		if (room)
+		{
+			SYACETRACERECORD *record = &trace->ring[head++ & (YACE_TRACE_RECORDS - 1)];
+
+			record->pc = pc;
+			record->opcode = opcode;
+			record->I = ctx->I;
+			record->vx = ctx->V[(opcode >> 8) & 0xF];
+			record->vf = ctx->V[0xF];
+			room--;
+		}
+		else
+			trace->lost++;
+	}
+
+	// One barrier and one wake up for the whole run
+	if (head != (Uint32)SDL_AtomicGet(&trace->head))
+	{
+		SDL_AtomicSet(&trace->head, (int)head);
+		SDL_SemPost(trace->filled);
+	}
+
+	return i;
+}
+
+// Stores a record in the byte order of the file
+void YACE_PackRecord(BYTE *out, const SYACETRACERECORD *record)
+{
+	out[0] = record->pc & 0xFF;
+	out[1] = record->pc >> 8;
+	out[2] = record->opcode & 0xFF;
+	out[3] = record->opcode >> 8;
+	out[4] = record->I & 0xFF;
+	out[5] = record->I >> 8;
+	out[6] = record->vx;
+	out[7] = record->vf;
+}
+
+// Drain thread, writes the records as the emulation publishes them
+int YACE_DrainTrace(void *data)
+{
+	SYACETRACE *trace = (SYACETRACE *)data;
+	BYTE chunk[YACE_TRACE_CHUNK * 8];
+
+	for (;;)
+	{
+		// Read before head, the last records are seen after a stop
+		int draining = SDL_AtomicGet(&trace->draining);
+		Uint32 tail = (Uint32)SDL_AtomicGet(&trace->tail);
+		Uint32 head = (Uint32)SDL_AtomicGet(&trace->head);
+		int count = 0;
+
+		if (head == tail)
+		{
+			if (!draining)
+				break;
+
+			SDL_SemWait(trace->filled);
+			continue;
+		}
+
+		while (tail != head && count < YACE_TRACE_CHUNK)
+			YACE_PackRecord(&chunk[8 * count++], &trace->ring[tail++ & (YACE_TRACE_RECORDS - 1)]);
+
+		fwrite(chunk, 8, count, trace->file);
+		SDL_AtomicSet(&trace->tail, (int)tail);
+	}
+
+	return 0;
+}
+
+// Opens the trace file and starts recording, returns 0 on errors
+int YACE_StartTrace(SCHIP8 *ctx, const char *filename)
+{
+	SYACETRACE *trace;
+
+	// The trace is kept with the engine state
+	if (!YACE_CreateEngines(ctx))
+		return 0;
+
+	if (!(trace = (SYACETRACE *)calloc(1, sizeof(SYACETRACE))))
+		return 0;
+
+	if (!(trace->filled = SDL_CreateSemaphore(0)))
+	{
+		free(trace);
+		return 0;
+	}
+
+	if (!(trace->file = fopen(filename, "wb")))
+	{
+		SDL_DestroySemaphore(trace->filled);
+		free(trace);
+		return 0;
+	}
+
+	fwrite(YACE_TRACE_MAGIC, 1, 8, trace->file);
+	trace->enabled = 1;
+	SDL_AtomicSet(&trace->draining, 1);
+
+	if (!(trace->thread = SDL_CreateThread(YACE_DrainTrace, "YACE trace", trace)))
+	{
+		fclose(trace->file);
+		SDL_DestroySemaphore(trace->filled);
+		free(trace);
+		return 0;
+	}
+
+	ctx->Engines->Trace = trace;
+	return 1;
+}
+
+// Pauses or resumes the recording, the engine of the context
+// runs while it's paused
+void YACE_EnableTrace(SCHIP8 *ctx, int enable)
+{
+	if (ctx->Engines && ctx->Engines->Trace)
+		ctx->Engines->Trace->enabled = enable;
+}
+
+// Returns 1 while the trace of the context is recording
+int YACE_TraceEnabled(SCHIP8 *ctx)
+{
+	return ctx->Engines && ctx->Engines->Trace && ctx->Engines->Trace->enabled;
+}
+
+// Writes what's left in the ring and closes the file, called
+// by the thread running the context
+void YACE_StopTrace(SCHIP8 *ctx)
+{
+	SYACETRACE *trace = ctx->Engines ? ctx->Engines->Trace : NULL;
+
+	if (!trace)
+		return;
+
+	SDL_AtomicSet(&trace->draining, 0);
+	SDL_SemPost(trace->filled);
+	SDL_WaitThread(trace->thread, NULL);
+	SDL_DestroySemaphore(trace->filled);
+
+	if (trace->lost)
+	{
+		SYACETRACERECORD gap = { YACE_TRACE_GAP, 0, 0, 0, 0 };
+		BYTE packed[8];
+
+		gap.opcode = (WORD)trace->lost;
+		gap.I = (WORD)(trace->lost >> 16);
+		YACE_PackRecord(packed, &gap);
+		fwrite(packed, 8, 1, trace->file);
+	}
+
+	fclose(trace->file);
+	free(trace);
+	ctx->Engines->Trace = NULL;
+}
+
+#endif // YACE_TRACE
+
+// Runs the engine of the context
+int YACE_RunEngine(SCHIP8 *ctx, int cycles)
+{
+#ifdef YACE_TRACE
+	if (YACE_TraceEnabled(ctx))
+		return YACE_RunTraced(ctx, cycles);
+#endif
+
+	// The others run the predecoded slots, kept in the engine state
+	if (ctx->engine != YACE_ENGINE_INTERPRETER && ctx->engine != YACE_ENGINE_PROFILE && !YACE_CreateEngines(ctx))
+		return YACE_RunInterpreter(ctx, cycles);
+
+	switch (ctx->engine)
+	{
+		case YACE_ENGINE_INTERPRETER:
+			return YACE_RunInterpreter(ctx, cycles);
+#ifdef YACE_HAS_THREADED
+		case YACE_ENGINE_THREADED:
+			return YACE_RunThreaded(ctx, cycles);
+#endif
+		case YACE_ENGINE_TAILCALL:
+			return YACE_RunTailCall(ctx, cycles);
+		case YACE_ENGINE_PROFILE:
+			return YACE_RunProfile(ctx, cycles);
+#ifdef YACE_HAS_JIT
+		case YACE_ENGINE_JIT:
+			return YACE_RunJit(ctx, cycles);
+#endif
+#ifdef YACE_AOT
+		case YACE_ENGINE_AOT:
+			return YACE_RunAot(ctx, cycles);
+#endif
+		default:
+			return YACE_RunCached(ctx, cycles);
+	}
+}
+
+// Executes the given number of instructions with the engine
+// of the context, returns the number of instructions executed,
+// always cycles: every engine stops on the budget
+int YACE_Run(SCHIP8 *ctx, int cycles)
+{
+	int done = YACE_RunEngine(ctx, cycles);
+
+	if (ctx->idle)
+	{
+		// The engine stopped on an idle loop, the iterations until
+		// the next frame would all be the same
+		done += ctx->idle - YACE_IDLE_CYCLES;
+
+		if (done < cycles)
+		{
+			int left = (cycles - done) % ctx->idle;
+
+			for (; left > 0; left--)
+				YACE_ExecuteOpcode(ctx, YACE_FetchOpcode(ctx));
+
+			done = cycles;
+		}
+
+		ctx->idle = 0;
+	}
+
+	SDL_assert(done == cycles);
+	return done;
+}
+
+// Runs one 60Hz frame: the timers count down, then the given
+// number of instructions are executed
+int YACE_RunFrame(SCHIP8 *ctx, int cycles)
+{
+	if (ctx->delayTimer > 0) ctx->delayTimer--;
+	if (ctx->soundTimer > 0) ctx->soundTimer--;
+
+	return YACE_Run(ctx, cycles);
+}
+
+// Returns the engine with the given name, -1 if unknown or
+// not built in (jit needs x86-64, aot a ROM from yace-aot)
+int YACE_EngineFromName(const char *name)
+{
+	if (!strcmp(name, "interpreter"))
+		return YACE_ENGINE_INTERPRETER;
+	if (!strcmp(name, "cached"))
+		return YACE_ENGINE_CACHED;
+#ifdef YACE_HAS_JIT
+	if (!strcmp(name, "jit"))
+		return YACE_ENGINE_JIT;
+#endif
+#ifdef YACE_AOT
+	if (!strcmp(name, "aot"))
+		return YACE_ENGINE_AOT;
+#endif
+	if (!strcmp(name, "threaded"))
+		return YACE_ENGINE_THREADED;
+	if (!strcmp(name, "tailcall"))
+		return YACE_ENGINE_TAILCALL;
+	if (!strcmp(name, "profile"))
+		return YACE_ENGINE_PROFILE;
+
+	return -1;
+}
+
+// *******************************************************
+// SDL and OpenGL front end, yace-batch builds the core alone
+// *******************************************************
+#ifndef YACE_BATCH
+
+// OpenGL functions past 1.1, loaded once the context exists
+// (opengl32.dll doesn't export them on Windows)
+#define YACE_FOREACH_GL(GL) \
+	GL(PFNGLCREATESHADERPROC, glCreateShader) \
+	GL(PFNGLSHADERSOURCEPROC, glShaderSource) \
+	GL(PFNGLCOMPILESHADERPROC, glCompileShader) \
+	GL(PFNGLGETSHADERIVPROC, glGetShaderiv) \
+	GL(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog) \
+	GL(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
+	GL(PFNGLATTACHSHADERPROC, glAttachShader) \
+	GL(PFNGLLINKPROGRAMPROC, glLinkProgram) \
+	GL(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
+	GL(PFNGLUSEPROGRAMPROC, glUseProgram) \
+	GL(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays) \
+	GL(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray) \
+	GL(PFNGLGENBUFFERSPROC, glGenBuffers) \
+	GL(PFNGLBINDBUFFERPROC, glBindBuffer) \
+	GL(PFNGLBUFFERDATAPROC, glBufferData) \
+	GL(PFNGLMAPBUFFERRANGEPROC, glMapBufferRange) \
+	GL(PFNGLUNMAPBUFFERPROC, glUnmapBuffer) \
+	GL(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer) \
+	GL(PFNGLENABLEVERTEXATTRIBARRAYPROC, glEnableVertexAttribArray)
+
+#define YACE_GL_DECLARE(type, name) type g_##name;
+#define YACE_GL_LOAD(type, name) \
+	if (!(g_##name = (type)SDL_GL_GetProcAddress(#name))) \
+		return 0;
+
+YACE_FOREACH_GL(YACE_GL_DECLARE)
+
+// Pixel buffers the uploads rotate through
+#define YACE_PBO_COUNT 2
+// Rewind history by default, and the bytes reserved for each frame
+// of it (games change a few dozen)
+#define YACE_REWIND_SECONDS 60
+#define YACE_REWIND_FRAME_BYTES 160
+
+// Window for screen, and its OpenGL context current on the render thread
+SDL_Window *g_window;
+SDL_GLContext g_glContext;
+// Rows of the screen held by the texture
+Uint64 g_shown[YACE_VIDEO_HEIGHT];
+// Pixel buffers streaming the rows to the texture, used in turn
+GLuint g_pbo[YACE_PBO_COUNT];
+int g_nextPbo;
+// Set when the window must be presented even if the screen didn't change
+SDL_atomic_t g_exposed;
+// Posted for a new frame, an exposed window or the exit, the render thread waits on it
+SDL_sem *g_redraw;
+// Keys down, bit N for key N, written by the input thread
+SDL_atomic_t g_keys;
+// Set while the emulator runs, cleared when the window closes
+SDL_atomic_t g_running;
+// Presses of the trace key not handled yet by the emulation thread
+SDL_atomic_t g_traceToggles;
+// Set while the rewind key is down
+SDL_atomic_t g_rewinding;
+// Set by the emulation thread while it runs the frames ahead
+int g_runningAhead;
+
+// Loads and stores of the emulation thread, inlined rather than
+// calls into SDL: an aligned int is read and written whole, the
+// barriers order it with the data it guards
+#define YACE_LOAD_ACQUIRE(atomic, out) \
+	do { (out) = *(volatile int *)&(atomic)->value; SDL_MemoryBarrierAcquire(); } while (0)
+#define YACE_STORE_RELEASE(atomic, in) \
+	do { SDL_MemoryBarrierRelease(); *(volatile int *)&(atomic)->value = (in); } while (0)
+
+// Host keys of the CHIP8 keys 0 - F, by default the left of a
+// QWERTY keyboard laid out like the COSMAC VIP keypad:
+//   1 2 3 C    1 2 3 4
+//   4 5 6 D    Q W E R
+//   7 8 9 E    A S D F
+//   A 0 B F    Z X C V
+SDL_Scancode g_keymap[16] =
+{
+	SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
+	SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+	SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
+	SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V
+};
+// CHIP8 key of each scancode, -1 if none (see YACE_InitKeymap)
+Sint8 g_keyOf[SDL_NUM_SCANCODES];
+
+// Builds the lookup of the keymap. The arrows keep the keys they
+// had before the keymap, unless it takes them.
+void YACE_InitKeymap(void)
+{
+	int i;
+
+	memset(g_keyOf, -1, sizeof(g_keyOf));
+	g_keyOf[SDL_SCANCODE_LEFT] = 9;
+	g_keyOf[SDL_SCANCODE_UP] = 1;
+	g_keyOf[SDL_SCANCODE_RIGHT] = 6;
+	g_keyOf[SDL_SCANCODE_DOWN] = 4;
+
+	for (i = 0; i < 16; i++)
+		g_keyOf[g_keymap[i]] = i;
+}
+
+// Reads a keymap given as the 16 host keys of 0 - F, like
+// "x123qweasdzc4rfv". Returns 0 if a key has no name.
+int YACE_ParseKeymap(const char *keys)
+{
+	int i;
+
+	if (strlen(keys) != 16)
+		return 0;
+
+	for (i = 0; i < 16; i++)
+	{
+		char name[2];
+
+		name[0] = keys[i];
+		name[1] = 0;
+
+		if ((g_keymap[i] = SDL_GetScancodeFromName(name)) == SDL_SCANCODE_UNKNOWN)
+			return 0;
+	}
+
+	return 1;
+}
+
+// **********************************
+// Lock-free triple buffer passing the
+// screens from the emulation thread to
+// the render thread. Each side owns a
+// slot, the third is swapped in between.
+// **********************************
+typedef struct _SYACEFRAMES
+{
+	Uint64 video[3][YACE_VIDEO_HEIGHT];
+	// Slot the emulation thread writes, and the one the render thread reads
+	int back;
+	int front;
+	// Slot in between, with YACE_FRAME_FRESH when it's newer than front
+	SDL_atomic_t middle;
+} SYACEFRAMES;
+
+#define YACE_FRAME_FRESH 4
+
+SYACEFRAMES g_frames = { { { 0 } }, 0, 2, { 1 } };
+
+// Atomic value &= mask
+void YACE_AtomicAnd(SDL_atomic_t *value, int mask)
+{
+	int old;
+
+	do
+		old = SDL_AtomicGet(value);
+	while (!SDL_AtomicCAS(value, old, old & mask));
+}
+
+// Atomic value |= mask
+void YACE_AtomicOr(SDL_atomic_t *value, int mask)
+{
+	int old;
+
+	do
+		old = SDL_AtomicGet(value);
+	while (!SDL_AtomicCAS(value, old, old | mask));
+}
+
+// **********************************
+// Lock-free queue of the key presses
+// for FX0A, from the input thread to
+// the emulation thread. A tap shorter
+// than a frame isn't lost.
+// **********************************
+#define YACE_PRESS_QUEUE 16
+
+typedef struct _SYACEPRESSES
+{
+	BYTE key[YACE_PRESS_QUEUE];
+	// Presses queued and taken so far, each written by one side
+	SDL_atomic_t write;
+	SDL_atomic_t read;
+	// Presses queued when the emulation thread last latched the keys
+	int latched;
+} SYACEPRESSES;
+
+SYACEPRESSES g_presses;
+
+// Queues a press, on the input thread. Dropped if 16 are waiting.
+void YACE_QueuePress(int key)
+{
+	int write = g_presses.write.value;
+
+	if (write - SDL_AtomicGet(&g_presses.read) < YACE_PRESS_QUEUE)
+	{
+		g_presses.key[write & (YACE_PRESS_QUEUE - 1)] = key;
+		SDL_AtomicSet(&g_presses.write, write + 1);
+	}
+}
+
+// Latches the keys for the frame about to run, on the emulation
+// thread. The presses queued before the last frame that FX0A
+// didn't take are dropped, unless the key is still down.
+void YACE_LatchInput(SCHIP8 *ctx)
+{
+	int keys;
+	int read = g_presses.read.value;
+
+	YACE_LOAD_ACQUIRE(&g_keys, keys);
+	ctx->Keys = (WORD)keys;
+
+	while (g_presses.latched - read > 0 &&
+		!((keys >> g_presses.key[read & (YACE_PRESS_QUEUE - 1)]) & 1))
+		read++;
+
+	YACE_STORE_RELEASE(&g_presses.read, read);
+	YACE_LOAD_ACQUIRE(&g_presses.write, g_presses.latched);
+}
+
+// Publishes the screen of the context as the latest frame
+void YACE_PublishFrame(SCHIP8 *ctx)
+{
+	memcpy(g_frames.video[g_frames.back], ctx->Video, sizeof(ctx->Video));
+	g_frames.back = SDL_AtomicSet(&g_frames.middle, g_frames.back | YACE_FRAME_FRESH) & 3;
+	SDL_SemPost(g_redraw);
+}
+
+// Returns the latest frame published, NULL if it was already taken
+const Uint64 *YACE_LatestFrame(void)
+{
+	if (!(SDL_AtomicGet(&g_frames.middle) & YACE_FRAME_FRESH))
+		return NULL;
+
+	g_frames.front = SDL_AtomicSet(&g_frames.middle, g_frames.front) & 3;
+	return g_frames.video[g_frames.front];
+}
+
+// Handles a key going down or up: the keypad, the rewind and trace keys
+void YACE_HandleKey(const SDL_KeyboardEvent *event)
+{
+	int down = event->type == SDL_KEYDOWN;
+	int key = g_keyOf[event->keysym.scancode];
+
+	switch (event->keysym.sym)
+	{
+		case SDLK_F12:
+			if (down && !event->repeat)
+				SDL_AtomicAdd(&g_traceToggles, 1);
+			break;
+		case SDLK_BACKSPACE:
+			SDL_AtomicSet(&g_rewinding, down);
+			break;
+	}
+
+	// The keypad follows the keys, not the auto-repeat
+	if (key < 0 || event->repeat)
+		return;
+
+	if (down)
+	{
+		YACE_AtomicOr(&g_keys, 1 << key);
+		YACE_QueuePress(key);
+	}
+	else
+		YACE_AtomicAnd(&g_keys, ~(1 << key));
+}
+
+// Longest wait of the input thread for an event, in ms
+#define YACE_INPUT_TIMEOUT 100
+
+// Handles a window event, on the input thread
+void YACE_HandleEvent(const SDL_Event *evt)
+{
+	switch (evt->type)
+	{
+		case SDL_QUIT:
+			SDL_AtomicSet(&g_running, 0);
+			break;
+
+		case SDL_WINDOWEVENT:
+		{
+			if (evt->window.event == SDL_WINDOWEVENT_EXPOSED)
+			{
+				SDL_AtomicSet(&g_exposed, 1);
+				SDL_SemPost(g_redraw);
+			}
+		} break;
+
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+			YACE_HandleKey(&evt->key);
+			break;
+	}
+}
+
+// Sleeps until window events come, on the input thread, then
+// handles every one queued so a burst of them doesn't wait for
+// the following frames. The emulation thread latches the keys
+// right before running the instructions of a frame.
+void YACE_WaitInput(void)
+{
+	SDL_Event evt;
+
+	if (!SDL_WaitEventTimeout(&evt, YACE_INPUT_TIMEOUT))
+		return;
+
+	do
+	{
+		YACE_HandleEvent(&evt);
+	}
+	while (SDL_PollEvent(&evt));
+}
+
+// Returns the index of the oldest key press queued, if any. Called
+// by the core on the emulation thread, a press is returned once:
+// the frames run ahead only look at it.
+int YACE_GetInput(SCHIP8 *ctx)
+{
+	int write;
+	int read = g_presses.read.value;
+
+	YACE_LOAD_ACQUIRE(&g_presses.write, write);
+	if (read == write)
+		return -1;
+
+	if (!g_runningAhead)
+		YACE_STORE_RELEASE(&g_presses.read, read + 1);
+
+	return g_presses.key[read & (YACE_PRESS_QUEUE - 1)];
+}
+
+// *******************************************************
+// Renderer
+//
+// The screen goes to the GPU as it's stored, one bit per
+// pixel: a 2x32 R32UI texture holds the 64-bit rows. A
+// fragment shader expands the bits to colors while one
+// fullscreen triangle scales them to the window.
+//
+// Rows are uploaded through a ring of pixel buffers: the
+// copy from the buffer to the texture runs on the GPU while
+// the next frame is emulated, and the buffer is orphaned
+// before being written so the driver never waits for it.
+// *******************************************************
+
+// The texel of a row holding pixels 0-31 (the high half) is
+// defined in front of the shaders, it depends on the byte order
+const char *g_vertexShader =
+	"layout(location = 0) in vec2 position;\n"
+	"out vec2 uv;\n"
+	"void main()\n"
+	"{\n"
+	"	// Row 0 is at the top\n"
+	"	uv = vec2(position.x + 1.0, 1.0 - position.y) * 0.5;\n"
+	"	gl_Position = vec4(position, 0.0, 1.0);\n"
+	"}\n";
+
+const char *g_fragmentShader =
+	"uniform usampler2D screen;\n"
+	"in vec2 uv;\n"
+	"out vec4 color;\n"
+	"void main()\n"
+	"{\n"
+	"	ivec2 pixel = min(ivec2(uv * vec2(64.0, 32.0)), ivec2(63, 31));\n"
+	"	uint row = texelFetch(screen, ivec2((pixel.x >> 5) ^ YACE_HIGH_TEXEL, pixel.y), 0).r;\n"
+	"	color = vec4(vec3(float((row >> (31 - (pixel.x & 31))) & 1u)), 1.0);\n"
+	"}\n";
+
+// Compiles a shader of the given type, returns 0 on errors
+GLuint YACE_CompileShader(GLenum type, const char *source)
+{
+	GLint status;
+	char log[512];
+	const char *sources[2];
+	GLuint shader = g_glCreateShader(type);
+
+	sources[0] = SDL_BYTEORDER == SDL_LIL_ENDIAN ?
+		"#version 330 core\n#define YACE_HIGH_TEXEL 1\n" :
+		"#version 330 core\n#define YACE_HIGH_TEXEL 0\n";
+	sources[1] = source;
+
+	g_glShaderSource(shader, 2, sources, NULL);
+	g_glCompileShader(shader);
+	g_glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+
+	if (!status)
+	{
+		g_glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		printf("YACE: can't compile the shader\n%s\n", log);
+		return 0;
+	}
+
+	return shader;
+}
+
+// Opens the window with an OpenGL 3.3 core context and sets up
+// the renderer, returns 0 on errors
+int YACE_InitScreen(SCHIP8 *ctx)
+{
+	// Fullscreen triangle, the window is the part with x and y in -1..1
+	static const GLfloat triangle[6] = { -1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f };
+	GLuint vertexShader, fragmentShader, program, vao, vbo, texture;
+	GLint status;
+
+	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER);
+
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
+
+	g_window = SDL_CreateWindow("Yace",
+		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		YACE_SCREEN_WIDTH, YACE_SCREEN_HEIGHT,
+		SDL_WINDOW_OPENGL);
+
+	if (!g_window || !(g_glContext = SDL_GL_CreateContext(g_window)))
+	{
+		printf("YACE: can't create an OpenGL 3.3 window (%s)\n", SDL_GetError());
+		return 0;
+	}
+
+	YACE_FOREACH_GL(YACE_GL_LOAD)
+
+	vertexShader = YACE_CompileShader(GL_VERTEX_SHADER, g_vertexShader);
+	fragmentShader = YACE_CompileShader(GL_FRAGMENT_SHADER, g_fragmentShader);
+
+	if (!vertexShader || !fragmentShader)
+		return 0;
+
+	program = g_glCreateProgram();
+	g_glAttachShader(program, vertexShader);
+	g_glAttachShader(program, fragmentShader);
+	g_glLinkProgram(program);
+	g_glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+	if (!status)
+	{
+		printf("YACE: can't link the shaders\n");
+		return 0;
+	}
+
+	g_glUseProgram(program);
+
+	g_glGenVertexArrays(1, &vao);
+	g_glBindVertexArray(vao);
+	g_glGenBuffers(1, &vbo);
+	g_glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	g_glBufferData(GL_ARRAY_BUFFER, sizeof(triangle), triangle, GL_STATIC_DRAW);
+	g_glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+	g_glEnableVertexAttribArray(0);
+
+	g_glGenBuffers(YACE_PBO_COUNT, g_pbo);
+	g_nextPbo = 0;
+
+	glViewport(0, 0, YACE_SCREEN_WIDTH, YACE_SCREEN_HEIGHT);
+	glDisable(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	memset(g_shown, 0, sizeof(g_shown));
+	SDL_AtomicSet(&g_exposed, 1);
+
+	// ******************************************
+	// Create the texture using the video memory
+	// ******************************************
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, 2, YACE_VIDEO_HEIGHT,
+		0, GL_RED_INTEGER, GL_UNSIGNED_INT, (GLvoid*)g_shown);
+
+	// Integer textures can't be filtered
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	return 1;
+}
+
+void YACE_BeginScene(void)
+{
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+// Uploads the rows of the frame that changed since the last call in
+// the texture. Returns the rows uploaded.
+int YACE_UpdateScreen(const Uint64 *video)
+{
+	int y, last;
+	int changed = 0;
+	Uint32 dirty = 0;
+	BYTE *pixels;
+	// Start of the rows for glTexSubImage2D, an offset in the pixel buffer
+	const BYTE *source = NULL;
+
+	for (y = 0; y < YACE_VIDEO_HEIGHT; y++)
+	{
+		if (video[y] == g_shown[y])
+			continue;
+
+		g_shown[y] = video[y];
+		dirty |= (Uint32)1 << y;
+		changed++;
+	}
+
+	if (!dirty)
+		return 0;
+
+	g_glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g_pbo[g_nextPbo]);
+	g_nextPbo = (g_nextPbo + 1) % YACE_PBO_COUNT;
+
+	// Orphan the storage, the GPU may still be reading the last frame
+	g_glBufferData(GL_PIXEL_UNPACK_BUFFER, sizeof(g_shown), NULL, GL_STREAM_DRAW);
+	pixels = (BYTE *)g_glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sizeof(g_shown),
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+	if (pixels)
+	{
+		for (y = 0; y < YACE_VIDEO_HEIGHT; y++)
+		{
+			if ((dirty >> y) & 1)
+				memcpy(pixels + y * sizeof(Uint64), &g_shown[y], sizeof(Uint64));
+		}
+
+		if (!g_glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+			pixels = NULL;
+	}
+
+	// Upload from the client memory if the buffer is lost
+	if (!pixels)
+	{
+		g_glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		source = (const BYTE *)g_shown;
+	}
+
+	// fill the texture now, a call for each run of changed rows
+	for (y = 0; y < YACE_VIDEO_HEIGHT; y = last)
+	{
+		last = y + 1;
+
+		if (!((dirty >> y) & 1))
+			continue;
+
+		while (last < YACE_VIDEO_HEIGHT && ((dirty >> last) & 1))
+			last++;
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y,
+			2, last - y,
+			GL_RED_INTEGER, GL_UNSIGNED_INT, (GLvoid*)(source + y * sizeof(Uint64)));
+	}
+
+	g_glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return changed;
+}
+
+void YACE_Render(SCHIP8 *ctx)
+{
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void YACE_EndScene(SCHIP8 *ctx)
+{
+	SDL_GL_SwapWindow(g_window);
+}
+
+// *******************************************************
+// Sound
+//
+// The tone sounds while the sound timer runs. The emulation
+// thread sends its edges, on and off, to the audio callback
+// through a lock-free queue, each stamped with the sample it
+// falls on: frame N starts at sample N * rate / 60 of the
+// emulated time. The callback plays them that far apart, a
+// buffer after they arrive.
+//
+// With -sync audio the device clock paces the emulation
+// instead: the callback walks the emulated time as it plays,
+// and the emulation thread runs a frame whenever it's less
+// than YACE_AUDIO_LEAD samples ahead. The step of the walk
+// stays within 0.5% of a sample, a bit longer while the
+// emulation is further ahead than usual, a bit shorter while
+// it's behind, so the output never runs past the frames
+// emulated and the screen stays within a frame of the sound.
+//
+// The square wave is band-limited with polyBLEP: the jumps of
+// the naive wave are rounded over a sample on each side, so it
+// doesn't alias. Its gain ramps over a millisecond on the edges
+// instead of clicking.
+// *******************************************************
+
+// Output rate asked for (the device may pick another) and
+// samples of a buffer, 5.3ms at 48kHz
+#define YACE_AUDIO_RATE 48000
+#define YACE_AUDIO_SAMPLES 256
+// Pitch and loudness of the tone
+#define YACE_TONE_FREQUENCY 440.0f
+#define YACE_TONE_VOLUME 8000.0f
+// Edges waiting for the callback, a power of 2
+#define YACE_EDGE_QUEUE 64
+// Audio sync: samples of emulated time not played yet under which
+// the next frame runs, fractional bits of the walk and the largest
+// change of its step
+#define YACE_AUDIO_LEAD (2 * YACE_AUDIO_SAMPLES)
+#define YACE_CURSOR_BITS 16
+#define YACE_RATE_CONTROL 0.005f
+// Audio sync: ms without a sample played after which the device is
+// taken as stalled and the frame runs anyway
+#define YACE_AUDIO_STALL 100
+
+typedef struct _SYACEEDGE
+{
+	// Sample of the emulated time the edge falls on
+	Uint64 when;
+	// Tone state from there on
+	int on;
+} SYACEEDGE;
+
+typedef struct _SYACEAUDIO
+{
+	SDL_AudioDeviceID device;
+	// Samples per second of the device
+	int rate;
+	// Set when the device clock paces the emulation
+	int sync;
+
+	// Queue of the edges, each counter written by one side
+	SYACEEDGE edge[YACE_EDGE_QUEUE];
+	SDL_atomic_t write;
+	SDL_atomic_t read;
+
+	// Emulation thread: frames timed so far and tone state sent last
+	Uint64 frame;
+	int sent;
+
+	// Audio sync: low 32 bits of the samples of emulated time
+	// emulated and played
+	SDL_atomic_t emulated;
+	SDL_atomic_t played;
+
+	// Callback: samples played, and the sample played at emulated sample 0
+	Uint64 clock;
+	Sint64 delta;
+	// Audio sync: emulated time played, in 1/65536 of a sample,
+	// the lead of the emulation smoothed, the range of the step
+	// and the buffers that ran out of emulated time
+	Uint64 cursor;
+	float lead;
+	float slowest;
+	float fastest;
+	int starved;
+	// Tone state, phase of the wave in 0..1, its step and gain
+	int on;
+	float phase;
+	float increment;
+	float gain;
+} SYACEAUDIO;
+
+SYACEAUDIO g_audio;
+
+// Correction of the square wave at a jump: t is the phase past it,
+// dt the step of the phase in a sample
+float YACE_PolyBlep(float t, float dt)
+{
+	if (t < dt)
+	{
+		t /= dt;
+		return t + t - t * t - 1.0f;
+	}
+
+	if (t > 1.0f - dt)
+	{
+		t = (t - 1.0f) / dt;
+		return t * t + t + t + 1.0f;
+	}
+
+	return 0.0f;
+}
+
+// Audio sync: returns the step of the emulated time for a sample
+// of this buffer, from how far the emulation is ahead
+Uint32 YACE_AudioStep(SYACEAUDIO *audio, int emulated)
+{
+	// Aimed at: the lead after a frame runs, halfway to the next one
+	float target = YACE_AUDIO_LEAD + audio->rate / YACE_FRAME_RATE / 2.0f;
+	float ratio;
+
+	audio->lead += ((int)((Uint32)emulated - (Uint32)(audio->cursor >> YACE_CURSOR_BITS)) - audio->lead) / 8.0f;
+	ratio = 1.0f + YACE_RATE_CONTROL * (audio->lead - target) / target;
+
+	if (ratio < 1.0f - YACE_RATE_CONTROL)
+		ratio = 1.0f - YACE_RATE_CONTROL;
+	if (ratio > 1.0f + YACE_RATE_CONTROL)
+		ratio = 1.0f + YACE_RATE_CONTROL;
+
+	if (ratio < audio->slowest)
+		audio->slowest = ratio;
+	if (ratio > audio->fastest)
+		audio->fastest = ratio;
+
+	return (Uint32)(ratio * (1 << YACE_CURSOR_BITS));
+}
+
+// Fills an audio buffer, on the audio thread of SDL: neither locks
+// nor allocates
+void SDLCALL YACE_AudioCallback(void *data, Uint8 *stream, int len)
+{
+	SYACEAUDIO *audio = (SYACEAUDIO *)data;
+	Sint16 *out = (Sint16 *)stream;
+	int count = len / (int)sizeof(Sint16);
+	int read = audio->read.value;
+	int write, i;
+	int emulated = 0;
+	int starved = 0;
+	Uint32 step = 0;
+	// Gain step of a sample, a ramp lasts 1ms
+	float gainStep = 1000.0f / audio->rate;
+
+	YACE_LOAD_ACQUIRE(&audio->write, write);
+
+	if (audio->sync)
+	{
+		YACE_LOAD_ACQUIRE(&audio->emulated, emulated);
+		step = YACE_AudioStep(audio, emulated);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		float t, value;
+
+		// Take the edges due by this sample
+		while (read != write)
+		{
+			const SYACEEDGE *edge = &audio->edge[read & (YACE_EDGE_QUEUE - 1)];
+
+			if (audio->sync)
+			{
+				if (edge->when > audio->cursor >> YACE_CURSOR_BITS)
+					break;
+			}
+			else
+			{
+				Sint64 at = (Sint64)edge->when + audio->delta - (Sint64)audio->clock;
+
+				// Late, or so early the latency would grow: the emulated
+				// time is tied to the output again, at this sample
+				if (at < 0 || at > 2 * YACE_AUDIO_SAMPLES)
+				{
+					audio->delta = (Sint64)audio->clock - (Sint64)edge->when;
+					at = 0;
+				}
+
+				if (at > 0)
+					break;
+			}
+
+			audio->on = edge->on;
+			read++;
+		}
+
+		if (audio->on)
+			audio->gain = audio->gain + gainStep < 1.0f ? audio->gain + gainStep : 1.0f;
+		else
+			audio->gain = audio->gain - gainStep > 0.0f ? audio->gain - gainStep : 0.0f;
+
+		// Square wave, high in the first half of the period
+		t = audio->phase;
+		value = t < 0.5f ? 1.0f : -1.0f;
+		value += YACE_PolyBlep(t, audio->increment);
+		t += 0.5f;
+		if (t >= 1.0f)
+			t -= 1.0f;
+		value -= YACE_PolyBlep(t, audio->increment);
+
+		audio->phase += audio->increment;
+		if (audio->phase >= 1.0f)
+			audio->phase -= 1.0f;
+
+		out[i] = (Sint16)(value * audio->gain * YACE_TONE_VOLUME);
+		audio->clock++;
+
+		// The walk waits at the last frame emulated, if any
+		if (audio->sync)
+		{
+			if ((int)((Uint32)emulated - (Uint32)((audio->cursor + step) >> YACE_CURSOR_BITS)) >= 0)
+				audio->cursor += step;
+			else if (emulated)
+				starved = 1;
+		}
+	}
+
+	YACE_STORE_RELEASE(&audio->read, read);
+
+	if (audio->sync)
+	{
+		audio->starved += starved;
+		YACE_STORE_RELEASE(&audio->played, (int)(Uint32)(audio->cursor >> YACE_CURSOR_BITS));
+	}
+}
+
+// Opens the audio device and starts the callback, returns 0 if
+// there's none: the emulator goes on silent, paced by the clock
+int YACE_InitAudio(int sync)
+{
+	SDL_AudioSpec want, have;
+
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+		return 0;
+
+	memset(&want, 0, sizeof(want));
+	want.freq = YACE_AUDIO_RATE;
+	want.format = AUDIO_S16SYS;
+	want.channels = 1;
+	want.samples = YACE_AUDIO_SAMPLES;
+	want.callback = YACE_AudioCallback;
+	want.userdata = &g_audio;
+
+	g_audio.device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if (!g_audio.device)
+		return 0;
+
+	g_audio.rate = have.freq;
+	g_audio.sync = sync;
+	g_audio.increment = YACE_TONE_FREQUENCY / have.freq;
+	g_audio.slowest = g_audio.fastest = 1.0f;
+	SDL_PauseAudioDevice(g_audio.device, 0);
+	return 1;
+}
+
+void YACE_CloseAudio(void)
+{
+	if (!g_audio.device)
+		return;
+
+	SDL_CloseAudioDevice(g_audio.device);
+	g_audio.device = 0;
+
+	if (g_audio.sync)
+	{
+		printf("YACE: the audio sync played at %.4f to %.4f of the rate, %d buffers ran out of frames\n",
+			g_audio.slowest, g_audio.fastest, g_audio.starved);
+		g_audio.sync = 0;
+	}
+}
+
+// Times the tone of the next frame, on the emulation thread once
+// a frame. An edge the full queue can't take is sent again with
+// the following frame.
+void YACE_PlaySound(int on)
+{
+	int write = g_audio.write.value;
+	int read;
+	Uint64 when;
+
+	g_audio.frame++;
+	if (!g_audio.device)
+		return;
+
+	when = g_audio.frame * g_audio.rate / YACE_FRAME_RATE;
+
+	if (on != g_audio.sent)
+	{
+		YACE_LOAD_ACQUIRE(&g_audio.read, read);
+		if (write - read < YACE_EDGE_QUEUE)
+		{
+			g_audio.edge[write & (YACE_EDGE_QUEUE - 1)].when = when;
+			g_audio.edge[write & (YACE_EDGE_QUEUE - 1)].on = on;
+			g_audio.sent = on;
+			YACE_STORE_RELEASE(&g_audio.write, write + 1);
+		}
+	}
+
+	// The frame just run covers the emulated time up to the next one
+	if (g_audio.sync)
+		YACE_STORE_RELEASE(&g_audio.emulated, (int)(Uint32)((g_audio.frame + 1) * g_audio.rate / YACE_FRAME_RATE));
+}
+
+// Audio sync: waits until less than YACE_AUDIO_LEAD samples of the
+// frames emulated are left to play. The callback only publishes what
+// it played, the thread sleeps about the time the device takes to
+// play the excess and looks again. If the device stops calling back,
+// the frames go on at a few per second.
+void YACE_WaitAudio(void)
+{
+	int played;
+	int last;
+	Uint32 waited = 0;
+	Uint32 emulated = (Uint32)g_audio.emulated.value;
+
+	YACE_LOAD_ACQUIRE(&g_audio.played, played);
+	last = played;
+
+	while ((int)(emulated - (Uint32)played) >= YACE_AUDIO_LEAD && SDL_AtomicGet(&g_running))
+	{
+		int excess = (int)(emulated - (Uint32)played) - YACE_AUDIO_LEAD + 1;
+		Uint32 ms = (Uint32)excess * 1000 / g_audio.rate + 1;
+
+		SDL_Delay(ms);
+		YACE_LOAD_ACQUIRE(&g_audio.played, played);
+
+		if (played != last)
+		{
+			last = played;
+			waited = 0;
+		}
+		else if ((waited += ms) >= YACE_AUDIO_STALL)
+			break;
+	}
+}
+
+// **********************************
+// Frame pacing: deadlines are counted
+// from the first frame, so rounding
+// never accumulates into drift
+// **********************************
+typedef struct _SYACEPACER
+{
+	// Performance counter at frame 0, and its frequency
+	Uint64 start;
+	Uint64 frequency;
+	// Frames paced since start
+	Uint64 frame;
+	// Counter ticks SDL_Delay may oversleep, the wait spins for them
+	Uint64 slack;
+} SYACEPACER;
+
+// Frames late after which the pacer starts over instead of catching up
+#define YACE_PACER_RESYNC 15
+
+void YACE_InitPacer(SYACEPACER *pacer)
+{
+	pacer->frequency = SDL_GetPerformanceFrequency();
+	pacer->start = SDL_GetPerformanceCounter();
+	pacer->frame = 0;
+	// Start with 2ms, it adapts to what the host scheduler delivers
+	pacer->slack = pacer->frequency / 500;
+}
+
+// Sleeps until shortly before the deadline of the next frame,
+// then spins the little time left
+void YACE_WaitFrame(SYACEPACER *pacer)
+{
+	Uint64 deadline;
+	Uint64 now = SDL_GetPerformanceCounter();
+
+	pacer->frame++;
+	deadline = pacer->start + pacer->frame * pacer->frequency / YACE_FRAME_RATE;
+
+	// After a stall, go on from now rather than running the lost frames in a burst
+	if (now > deadline + YACE_PACER_RESYNC * pacer->frequency / YACE_FRAME_RATE)
+	{
+		pacer->start = now;
+		pacer->frame = 0;
+		return;
+	}
+
+	while (now + pacer->slack < deadline)
+	{
+		Uint32 ms = (Uint32)((deadline - pacer->slack - now) * 1000 / pacer->frequency);
+		Uint64 wake;
+
+		if (!ms)
+			break;
+
+		wake = now + ms * pacer->frequency / 1000;
+		SDL_Delay(ms);
+		now = SDL_GetPerformanceCounter();
+
+		// Follow the worst oversleep at once, forget it slowly
+		if (now > wake + pacer->slack)
+			pacer->slack = now - wake;
+		else if (now > wake)
+			pacer->slack -= (pacer->slack - (now - wake)) / 16;
+	}
+
+	while (now < deadline)
+		now = SDL_GetPerformanceCounter();
+}
+
+// Instructions per second
+int g_ips = YACE_DEFAULT_IPS;
+// Frames run unpaced at the start, as fast as the host allows
+int g_turboFrames = 0;
+// Seconds of rewind history, none if 0
+int g_rewindSeconds = YACE_REWIND_SECONDS;
+SYACEREWIND *g_rewind = NULL;
+// Frames emulated ahead of the one shown, hiding the input lag of the games
+int g_runAhead = 0;
+
+// Runs the frames ahead with the input of the frame just run,
+// publishes the screen of the last one and goes back. The trace
+// and the sound follow the real frames only.
+void YACE_RunAhead(SCHIP8 *ctx, int cycles)
+{
+	int i;
+	SYACESTATE state;
+#ifdef YACE_TRACE
+	int tracing = YACE_TraceEnabled(ctx);
+
+	YACE_EnableTrace(ctx, 0);
+#endif
+
+	YACE_SaveState(ctx, &state);
+	g_runningAhead = 1;
+
+	for (i = 0; i < g_runAhead; i++)
+		YACE_RunFrame(ctx, cycles);
+
+	g_runningAhead = 0;
+
+	if (ctx->dirtyRows)
+	{
+		ctx->dirtyRows = 0;
+		YACE_PublishFrame(ctx);
+	}
+
+	// The rows that differ from the screen shown stay dirty
+	YACE_LoadState(ctx, &state);
+
+#ifdef YACE_TRACE
+	YACE_EnableTrace(ctx, tracing);
+#endif
+}
+
+// Emulation thread, runs the frames at 60Hz and publishes
+// the screens that changed. The turbo frames come first.
+int YACE_EmulationThread(void *data)
+{
+	SCHIP8 *ctx = (SCHIP8 *)data;
+	SYACEPACER pacer;
+	int cycles, done, rewinding;
+	// Instructions per second not run yet, carried to the next frame
+	int remainder = 0;
+	int frames = 0;
+	Uint64 instructions = 0;
+	Uint64 start = SDL_GetPerformanceCounter();
+	// Counter ticks spent emulating, in all and in the slowest frame, and the frames
+	Uint64 busy = 0;
+	Uint64 worst = 0;
+	Uint64 emulated = 0;
+
+	YACE_InitPacer(&pacer);
+
+	if (g_rewind)
+		YACE_PushRewind(g_rewind, ctx);
+
+	while (SDL_AtomicGet(&g_running))
+	{
+		if (frames >= g_turboFrames)
+		{
+			if (g_audio.sync)
+				YACE_WaitAudio();
+			else
+				YACE_WaitFrame(&pacer);
+		}
+
+#ifdef YACE_TRACE
+		// F12 pauses and resumes the trace
+		if (SDL_AtomicSet(&g_traceToggles, 0) & 1)
+			YACE_EnableTrace(ctx, !YACE_TraceEnabled(ctx));
+#endif
+
+		// Backspace runs the frames backwards
+		rewinding = g_rewind && SDL_AtomicGet(&g_rewinding);
+
+		if (rewinding)
+			YACE_StepRewind(g_rewind, ctx);
+		else
+		{
+			Uint64 begin = SDL_GetPerformanceCounter();
+
+			remainder += g_ips;
+			cycles = remainder / YACE_FRAME_RATE;
+			remainder %= YACE_FRAME_RATE;
+
+			YACE_LatchInput(ctx);
+			done = YACE_RunFrame(ctx, cycles);
+
+			if (g_rewind)
+				YACE_PushRewind(g_rewind, ctx);
+
+			if (g_runAhead)
+				YACE_RunAhead(ctx, cycles);
+
+			begin = SDL_GetPerformanceCounter() - begin;
+			busy += begin;
+			emulated++;
+			if (begin > worst)
+				worst = begin;
+
+			if (frames < g_turboFrames)
+			{
+				instructions += done;
+
+				// Report, then go on at the normal pace
+				if (++frames == g_turboFrames)
+				{
+					double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+					printf("YACE: turbo ran %d frames, %llu instructions in %.1f ms, %.3f MIPS\n",
+						frames, (unsigned long long)instructions, ms, ms > 0 ? instructions / ms / 1000.0 : 0.0);
+					YACE_InitPacer(&pacer);
+				}
+			}
+		}
+
+		// The tone is off while the frames go backwards, the turbo
+		// frames aren't heard
+		if (frames >= g_turboFrames)
+			YACE_PlaySound(!rewinding && ctx->soundTimer > 0);
+
+		// With run-ahead the real frames aren't shown
+		if (ctx->dirtyRows && (!g_runAhead || rewinding))
+		{
+			ctx->dirtyRows = 0;
+			YACE_PublishFrame(ctx);
+		}
+	}
+
+	if (g_runAhead && emulated)
+	{
+		double frequency = (double)SDL_GetPerformanceFrequency();
+
+		printf("YACE: with %d frames of run-ahead a frame took %.3f ms on average, %.3f ms at worst\n",
+			g_runAhead, busy * 1000.0 / frequency / emulated, worst * 1000.0 / frequency);
+	}
+
+	return 0;
+}
+
+// Render thread, presents the latest frame. The swap waiting for
+// the vertical blank holds back neither the input nor the emulation.
+int YACE_RenderThread(void *data)
+{
+	SCHIP8 *ctx = (SCHIP8 *)data;
+
+	SDL_GL_MakeCurrent(g_window, g_glContext);
+	SDL_GL_SetSwapInterval(1);
+
+	while (SDL_AtomicGet(&g_running))
+	{
+		const Uint64 *video = YACE_LatestFrame();
+		int changed = video && YACE_UpdateScreen(video);
+
+		// Present only when the screen changed, then sleep until
+		// the next frame or expose
+		if (SDL_AtomicSet(&g_exposed, 0) || changed)
+		{
+			YACE_BeginScene();
+			YACE_Render(ctx);
+			YACE_EndScene(ctx);
+		}
+		else
+			SDL_SemWait(g_redraw);
+	}
+
+	SDL_GL_MakeCurrent(g_window, NULL);
+	return 0;
+}
+
+// Runs the emulation and render threads until the window closes.
+// This thread created the window, so it gets its events: it's
+// left to wait for them and handle them as soon as they come.
+void YACE_Loop(SCHIP8 *ctx)
+{
+	SDL_Thread *emulation = NULL;
+	SDL_Thread *render = NULL;
+
+	if (!(g_redraw = SDL_CreateSemaphore(0)))
+	{
+		printf("YACE: can't start the threads (%s)\n", SDL_GetError());
+		return;
+	}
+
+	SDL_AtomicSet(&g_running, 1);
+
+	// The emulation thread owns the context from here, the render
+	// thread the OpenGL context
+	YACE_PublishFrame(ctx);
+	SDL_GL_MakeCurrent(g_window, NULL);
+	emulation = SDL_CreateThread(YACE_EmulationThread, "YACE emulation", ctx);
+	render = SDL_CreateThread(YACE_RenderThread, "YACE render", ctx);
+
+	if (!emulation || !render)
+	{
+		printf("YACE: can't start the threads (%s)\n", SDL_GetError());
+		SDL_AtomicSet(&g_running, 0);
+	}
+
+	while (SDL_AtomicGet(&g_running))
+		YACE_WaitInput();
+
+	// Wake the render thread to see it's over
+	SDL_SemPost(g_redraw);
+
+	if (emulation)
+		SDL_WaitThread(emulation, NULL);
+	if (render)
+		SDL_WaitThread(render, NULL);
+
+	SDL_DestroySemaphore(g_redraw);
+	g_redraw = NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	int keymap = 1;
+	int sync = 0;
+	int unknown = 0;
+	char *rom = NULL;
+#ifdef YACE_TRACE
+	char *trace = NULL;
+#endif
+	SCHIP8 *emu = (SCHIP8 *)calloc(1, sizeof(SCHIP8));
+
+	emu->engine = YACE_ENGINE_THREADED;
+	// First reset the emulator state
+	YACE_Reset(emu);
+	YACE_SeedRandom(emu, time(NULL));
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-engine") && i + 1 < argc)
+			emu->engine = YACE_EngineFromName(argv[++i]);
+		else if (!strcmp(argv[i], "-ips") && i + 1 < argc)
+			g_ips = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-turbo") && i + 1 < argc)
+			g_turboFrames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-rewind") && i + 1 < argc)
+			g_rewindSeconds = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-runahead") && i + 1 < argc)
+			g_runAhead = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-clip"))
+			emu->clip = 1;
+		else if (!strcmp(argv[i], "-keymap") && i + 1 < argc)
+			keymap = YACE_ParseKeymap(argv[++i]);
+		else if (!strcmp(argv[i], "-sync") && i + 1 < argc)
+		{
+			i++;
+			sync = !strcmp(argv[i], "audio") ? 1 : !strcmp(argv[i], "clock") ? 0 : -1;
+		}
+#ifdef YACE_TRACE
+		else if (!strcmp(argv[i], "-trace") && i + 1 < argc)
+			trace = argv[++i];
+#endif
+		// An unknown option or one missing its value
+		else if (argv[i][0] == '-')
+			unknown = 1;
+		else
+			rom = argv[i];
+	}
+
+	if (!rom || unknown || !keymap || emu->engine < 0 || g_ips < 1 || g_turboFrames < 0 ||
+		g_rewindSeconds < 0 || g_runAhead < 0 || sync < 0)
+	{
+		YACE_Message();
+		free(emu);
+		return 1;
+	}
+
+	// load the ROM in RAM starting from 0x200 until 0xfff
+	if (!YACE_OpenROM(emu, rom))
+	{
+		printf("YACE: can't load %s, a ROM is 1 to %d bytes\n", rom, YACE_ROM_MAX);
+		free(emu);
+		return 1;
+	}
+
+	YACE_InitKeymap();
+
+	if (!YACE_InitScreen(emu))
+	{
+		YACE_FreeEngines(emu);
+		free(emu);
+		return 1;
+	}
+
+	if (!YACE_InitAudio(sync))
+		printf("YACE: no sound, the frames follow the clock (%s)\n", SDL_GetError());
+
+#ifdef YACE_TRACE
+	if (trace && !YACE_StartTrace(emu, trace))
+	{
+		printf("YACE: can't write the trace %s\n", trace);
+		YACE_FreeEngines(emu);
+		free(emu);
+		return 1;
+	}
+#endif
+
+	if (g_rewindSeconds)
+	{
+		int frames = g_rewindSeconds * YACE_FRAME_RATE;
+
+		if (!(g_rewind = YACE_CreateRewind(frames, frames * YACE_REWIND_FRAME_BYTES)))
+			printf("YACE: can't allocate %d seconds of rewind\n", g_rewindSeconds);
+	}
+
+	YACE_Loop(emu);
+
+#ifdef YACE_TRACE
+	YACE_StopTrace(emu);
+#endif
+	YACE_CloseAudio();
+	YACE_FreeRewind(g_rewind);
+	YACE_FreeEngines(emu);
+	free(emu);
+	return 0;
+}
+
+#endif // YACE_BATCH
@@ -0,0 +1,283 @@
+// *******************************************************
+// YACE - Yet Another CHIP8 Emulator
+// 
+// Copyright (c) 2014 Mainieri "Lazharous" Paolo
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+// See http://en.wikipedia.org/wiki/CHIP-8 and
+// http://devernay.free.fr/hacks/chip8/C8TECH10.HTM for references on the CHIP8
+// *******************************************************
+
+#ifndef _YACE_CHIP8_H
+#define _YACE_CHIP8_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <SDL.h>
+
+#define YACE_STACK_SIZE 16
+#define YACE_ROM_SIZE 0xFFF
+#define YACE_SCREEN_WIDTH 640
+#define YACE_SCREEN_HEIGHT 320
+#define YACE_SCREEN_SCALE 10
+#define YACE_VIDEO_WIDTH 64
+#define YACE_VIDEO_HEIGHT 32
+// Every bit of SCHIP8.dirtyRows
+#define YACE_ALL_ROWS 0xFFFFFFFF
+#define YACE_CODE_START 0x200
+#define YACE_CODE_SLOTS (0x1000 - YACE_CODE_START)
+// Largest ROM, loaded from 0x200 to the end of the RAM
+#define YACE_ROM_MAX (0x1000 - YACE_CODE_START)
+// Frames per second, the timers count down once a frame
+#define YACE_FRAME_RATE 60
+// Instructions executed every second, by default
+#define YACE_DEFAULT_IPS 400
+// Instructions executed every frame
+#define YACE_FRAME_CYCLES (YACE_DEFAULT_IPS / YACE_FRAME_RATE)
+// Seed of the CXNN generator after a reset
+#define YACE_RANDOM_SEED 0x5EED
+
+// Execution engines
+#define YACE_ENGINE_INTERPRETER 0
+#define YACE_ENGINE_CACHED 1
+#define YACE_ENGINE_JIT 2
+#define YACE_ENGINE_AOT 3
+#define YACE_ENGINE_THREADED 4
+#define YACE_ENGINE_TAILCALL 5
+#define YACE_ENGINE_PROFILE 6
+
+// BYTE and WORD come from windows.h on Windows
+#ifdef _WIN32
+#include <windows.h>
+#else
+typedef Uint8 BYTE;
+typedef Uint16 WORD;
+#endif
+
+struct _SCHIP8;
+typedef struct _SYACEINST SYACEINST;
+typedef struct _SYACEENGINES SYACEENGINES;
+typedef struct _SYACEJIT SYACEJIT;
+typedef struct _SYACETRACE SYACETRACE;
+
+// Executes a predecoded instruction, PC already points to the next one.
+// Returns the number of instructions executed (fused slots run more)
+typedef int (*YACE_OPHANDLER)(struct _SCHIP8 *ctx, SYACEINST *inst);
+
+// **********************************
+// Predecoded instruction slot
+// **********************************
+struct _SYACEINST
+{
+	// Handler of the instruction
+	YACE_OPHANDLER handler;
+	// Address NNN
+	WORD nnn;
+	// Registers X and Y
+	BYTE x;
+	BYTE y;
+	// Constants NN and N
+	BYTE nn;
+	BYTE n;
+	// Operation (YACE_OP_*), used by the threaded engines
+	BYTE op;
+	// Most instructions the slot may execute, the engines run
+	// a superinstruction longer than the budget left unfused
+	BYTE length;
+};
+
+// **********************************
+// State of the engines of a context,
+// allocated by the first engine
+// needing it (see YACE_CreateEngines)
+// **********************************
+struct _SYACEENGINES
+{
+	// Predecoded instructions, one slot for each address from 0x200
+	SYACEINST Code[YACE_CODE_SLOTS];
+	// Recompiler state, allocated when the JIT engine first runs
+	SYACEJIT *Jit;
+	// Execution trace, open from YACE_StartTrace (builds with YACE_TRACE)
+	SYACETRACE *Trace;
+};
+
+// **********************************
+// Structure holding the Chip8 state
+//
+// The registers every instruction touches
+// come first, within 64 bytes, then memory
+// and screen, then the engine settings.
+// The engine state is a separate block,
+// so a context stays small. Host handles
+// live in the front end.
+// **********************************
+typedef struct _SCHIP8
+{
+	// Registers V0 - VF
+	// The VF register doubles as a carry flag
+	BYTE V[16];
+	// Address register
+	WORD I;
+	// Program counter
+	WORD PC;
+	// Keyboard buttons, bit N is set while key N is down
+	WORD Keys;
+	// Stack pointer
+	BYTE SP;
+	// Delay Timer, count down to 0 at 60Hz
+	BYTE delayTimer;
+	// Sound Timer, count down to 0 at 60Hz
+	BYTE soundTimer;
+	// Stack (should be 12), SP wraps around it
+	WORD Stack[YACE_STACK_SIZE];
+	// Instructions of the idle loop the engine stopped on, 0 if none
+	int idle;
+	// State of the CXNN generator (xoshiro128**)
+	Uint32 Random[4];
+	// RAM is 4kb
+	BYTE RAM[4096];
+	// Video Screen, one bit per pixel: row Y is Video[Y],
+	// pixel X its bit 63 - X
+	Uint64 Video[YACE_VIDEO_HEIGHT];
+	// Rows of Video drawn since the front end last showed them, bit Y for row Y
+	Uint32 dirtyRows;
+	// Execution engine (YACE_ENGINE_*)
+	int engine;
+	// Sprites are clipped at the screen edges instead of wrapping around (-clip)
+	int clip;
+	// Set when the loaded ROM differs from the one built in
+	// by yace-aot, or when the guest wrote over it
+	int aotDirty;
+	// Size and CRC32 of the ROM loaded, to key caches and profiles
+	int romSize;
+	Uint32 romCrc;
+	// Predecoded instructions, recompiler and trace, NULL until an engine needs them
+	SYACEENGINES *Engines;
+} SCHIP8;
+
+// Returns 1 while the key (low nibble) is down
+#define YACE_KEY_DOWN(ctx, key) (((ctx)->Keys >> ((key) & 0xF)) & 1)
+
+// The guest state is the start of SCHIP8, up to the front end
+// and engine fields, so a snapshot is a single copy
+#define YACE_STATE_SIZE ((int)offsetof(SCHIP8, dirtyRows))
+
+// **********************************
+// Snapshot of the guest state
+// **********************************
+typedef struct _SYACESTATE
+{
+	BYTE data[YACE_STATE_SIZE];
+} SYACESTATE;
+
+// Frames of rewind history (see YACE_CreateRewind)
+typedef struct _SYACEREWIND SYACEREWIND;
+
+// *********************
+// functions prototypes
+// *********************
+void YACE_Message(void);
+void YACE_Reset(SCHIP8 *ctx);
+
+int YACE_OpenROM(SCHIP8 *ctx, const char *filename);
+int YACE_LoadROM(SCHIP8 *ctx, const BYTE *data, int size);
+Uint32 YACE_Crc32(const BYTE *data, int size);
+WORD YACE_FetchOpcode(SCHIP8 *ctx);
+void YACE_ExecuteOpcode(SCHIP8 *ctx, WORD opcode);
+int YACE_Run(SCHIP8 *ctx, int cycles);
+int YACE_RunFrame(SCHIP8 *ctx, int cycles);
+int YACE_RunSlot(SCHIP8 *ctx, int left);
+int YACE_EngineFromName(const char *name);
+
+SYACEENGINES *YACE_CreateEngines(SCHIP8 *ctx);
+void YACE_FreeEngines(SCHIP8 *ctx);
+void YACE_FlushCode(SCHIP8 *ctx);
+void YACE_InvalidateCode(SCHIP8 *ctx, int address, int size);
+void YACE_DecodeInstruction(SYACEINST *inst, WORD opcode);
+
+void YACE_SaveState(SCHIP8 *ctx, SYACESTATE *state);
+void YACE_LoadState(SCHIP8 *ctx, const SYACESTATE *state);
+SYACEREWIND *YACE_CreateRewind(int frames, int bytes);
+void YACE_FreeRewind(SYACEREWIND *rewind);
+void YACE_PushRewind(SYACEREWIND *rewind, SCHIP8 *ctx);
+int YACE_StepRewind(SYACEREWIND *rewind, SCHIP8 *ctx);
+
+int YACE_RunJit(SCHIP8 *ctx, int cycles);
+void YACE_FreeJit(SCHIP8 *ctx);
+
+#ifdef YACE_TRACE
+int YACE_StartTrace(SCHIP8 *ctx, const char *filename);
+void YACE_EnableTrace(SCHIP8 *ctx, int enable);
+int YACE_TraceEnabled(SCHIP8 *ctx);
+void YACE_StopTrace(SCHIP8 *ctx);
+#endif
+
+#ifdef YACE_AOT
+// Provided by the translation unit generated by yace-aot
+int YACE_RunAot(SCHIP8 *ctx, int cycles);
+void YACE_AotFlush(SCHIP8 *ctx);
+void YACE_AotInvalidate(SCHIP8 *ctx, int address, int size);
+#endif
+
+// Lockstep batch of contexts running the same ROM (chip8_lanes.c)
+typedef struct _SYACELANES SYACELANES;
+
+SYACELANES *YACE_CreateLanes(SCHIP8 **contexts, int count);
+void YACE_FreeLanes(SYACELANES *lanes);
+Uint64 YACE_RunLanes(SYACELANES *lanes, int frames, int cycles);
+
+void YACE_ShowHexROM(SCHIP8 *ctx);
+Uint64 YACE_HashScreen(SCHIP8 *ctx);
+void YACE_SeedRandom(SCHIP8 *ctx, Uint64 seed);
+Uint32 YACE_Random(SCHIP8 *ctx);
+
+int YACE_InitScreen(SCHIP8 *ctx);
+void YACE_BeginScene(void);
+int YACE_UpdateScreen(const Uint64 *video);
+void YACE_Render(SCHIP8 *ctx);
+void YACE_EndScene(SCHIP8 *ctx);
+
+// Provided by the front end (yace-batch replays scripted input)
+int YACE_GetInput(SCHIP8 *ctx);
+void YACE_PlaySound(int on);
+
+void YACE_Decode0NNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_Execute1NNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_Execute2NNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_Execute3XNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_Execute4XNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_Execute5XY0Opcode(SCHIP8 *ctx, WORD opcode);
+void YACE_Execute6XNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_Execute7XNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_Decode8XYNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_Execute9XY0Opcode(SCHIP8 *ctx, WORD opcode);
+void YACE_ExecuteANNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_ExecuteBNNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_ExecuteCXNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_ExecuteDXYNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_DecodeEXNNOpcode(SCHIP8 *ctx, WORD opcode);
+void YACE_DecodeFXNNOpcode(SCHIP8 *ctx, WORD opcode);
+
+void YACE_ClearScreen(SCHIP8 *ctx);
+void YACE_DrawSprite(SCHIP8 *ctx, WORD xcoord, WORD ycoord, WORD height);
+int YACE_WaitKey(SCHIP8 *ctx, int x);
+void YACE_StoreBCD(SCHIP8 *ctx, int value);
+void YACE_StoreRegisters(SCHIP8 *ctx, int N);
+void YACE_LoadRegisters(SCHIP8 *ctx, int N);
+
+#endif // _YACE_CHIP8_H
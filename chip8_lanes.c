@@ -0,0 +1,561 @@
+// *******************************************************
+// YACE - Yet Another CHIP8 Emulator
+//
+// Copyright (c) 2014 Mainieri "Lazharous" Paolo
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+// Lockstep batch core
+//
+// Runs many contexts loaded with the same ROM together. The
+// registers of every context are kept in lane arrays (V0 of
+// all the lanes, then V1...), so an opcode is fetched and
+// decoded once for all the lanes at the same PC, and the
+// register operations run on AVX2/SSE2 vectors of lanes.
+// Memory, screen, stack and key operations run lane by lane
+// with the reference interpreter on the contexts.
+//
+// Lanes diverge on skips and computed jumps: each step runs
+// the lowest PC among the lanes with instructions left in the
+// frame, so the lanes that skipped wait for the other ones
+// to reach them. Every lane still executes its own program
+// order and budget exactly.
+// *******************************************************
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "chip8.h"
+
+// *******************************************************
+// Vectors of YACE_LANE_WIDTH 16-bit lanes. Masks have every
+// bit of the selected lanes set.
+// *******************************************************
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define YACE_LANE_WIDTH 16
+typedef __m256i YACE_VEC;
+
+#define YACE_VLoad(p) _mm256_loadu_si256((const __m256i *)(p))
+#define YACE_VStore(p, a) _mm256_storeu_si256((__m256i *)(p), (a))
+#define YACE_VSet(x) _mm256_set1_epi16((short)(x))
+#define YACE_VAdd(a, b) _mm256_add_epi16((a), (b))
+#define YACE_VSub(a, b) _mm256_sub_epi16((a), (b))
+#define YACE_VAnd(a, b) _mm256_and_si256((a), (b))
+#define YACE_VOr(a, b) _mm256_or_si256((a), (b))
+#define YACE_VXor(a, b) _mm256_xor_si256((a), (b))
+// b without the lanes of m
+#define YACE_VAndNot(m, b) _mm256_andnot_si256((m), (b))
+#define YACE_VEq(a, b) _mm256_cmpeq_epi16((a), (b))
+#define YACE_VMin(a, b) _mm256_min_epu16((a), (b))
+#define YACE_VShr(a, n) _mm256_srli_epi16((a), (n))
+#define YACE_VShl(a, n) _mm256_slli_epi16((a), (n))
+// b in the lanes of m, a in the other ones
+#define YACE_VBlend(a, b, m) _mm256_blendv_epi8((a), (b), (m))
+#define YACE_VAny(m) _mm256_movemask_epi8(m)
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#define YACE_LANE_WIDTH 8
+typedef __m128i YACE_VEC;
+
+#define YACE_VLoad(p) _mm_loadu_si128((const __m128i *)(p))
+#define YACE_VStore(p, a) _mm_storeu_si128((__m128i *)(p), (a))
+#define YACE_VSet(x) _mm_set1_epi16((short)(x))
+#define YACE_VAdd(a, b) _mm_add_epi16((a), (b))
+#define YACE_VSub(a, b) _mm_sub_epi16((a), (b))
+#define YACE_VAnd(a, b) _mm_and_si128((a), (b))
+#define YACE_VOr(a, b) _mm_or_si128((a), (b))
+#define YACE_VXor(a, b) _mm_xor_si128((a), (b))
+#define YACE_VAndNot(m, b) _mm_andnot_si128((m), (b))
+#define YACE_VEq(a, b) _mm_cmpeq_epi16((a), (b))
+// SSE2 has no unsigned 16-bit min: a - max(a - b, 0)
+#define YACE_VMin(a, b) _mm_sub_epi16((a), _mm_subs_epu16((a), (b)))
+#define YACE_VShr(a, n) _mm_srli_epi16((a), (n))
+#define YACE_VShl(a, n) _mm_slli_epi16((a), (n))
+#define YACE_VBlend(a, b, m) _mm_or_si128(_mm_and_si128((m), (b)), _mm_andnot_si128((m), (a)))
+#define YACE_VAny(m) _mm_movemask_epi8(m)
+
+#else
+
+// One lane at a time
+#define YACE_LANE_WIDTH 1
+typedef WORD YACE_VEC;
+
+#define YACE_VLoad(p) (*(p))
+#define YACE_VStore(p, a) (*(p) = (a))
+#define YACE_VSet(x) ((WORD)(x))
+#define YACE_VAdd(a, b) ((WORD)((a) + (b)))
+#define YACE_VSub(a, b) ((WORD)((a) - (b)))
+#define YACE_VAnd(a, b) ((WORD)((a) & (b)))
+#define YACE_VOr(a, b) ((WORD)((a) | (b)))
+#define YACE_VXor(a, b) ((WORD)((a) ^ (b)))
+#define YACE_VAndNot(m, b) ((WORD)(~(m) & (b)))
+#define YACE_VEq(a, b) ((WORD)((a) == (b) ? 0xFFFF : 0))
+#define YACE_VMin(a, b) ((a) < (b) ? (a) : (b))
+#define YACE_VShr(a, n) ((WORD)((a) >> (n)))
+#define YACE_VShl(a, n) ((WORD)((a) << (n)))
+#define YACE_VBlend(a, b, m) ((WORD)(((a) & ~(m)) | ((b) & (m))))
+#define YACE_VAny(m) (m)
+
+#endif
+
+#define YACE_VNot(m) YACE_VXor((m), YACE_VSet(0xFFFF))
+// Unsigned a > b
+#define YACE_VGt(a, b) YACE_VNot(YACE_VEq(YACE_VMin((a), (b)), (a)))
+// 1 in the lanes of m
+#define YACE_VBit(m) YACE_VAnd((m), YACE_VSet(1))
+
+// **********************************
+// Lanes of a batch
+// **********************************
+struct _SYACELANES
+{
+	// Lanes in use, and allocated (a multiple of YACE_LANE_WIDTH)
+	int count;
+	int stride;
+	// Contexts of the lanes, they hold memory, screen, stack and keys
+	SCHIP8 **ctx;
+	// Registers of the lanes, the context ones are stale while running.
+	// V holds bytes widened to 16 bits, the kernels wrap them at 8 bits
+	WORD *V[16];
+	WORD *I;
+	WORD *PC;
+	WORD *delayTimer;
+	WORD *soundTimer;
+	// Instructions left in the frame, 0 for the padding lanes
+	WORD *left;
+	// Addresses where the lanes may hold different bytes, opcodes
+	// there are fetched lane by lane
+	BYTE written[0x1000];
+};
+
+// Creates the batch of the contexts, that must have been loaded with
+// the same ROM. Returns NULL when out of memory.
+SYACELANES *YACE_CreateLanes(SCHIP8 **contexts, int count)
+{
+	int i, j;
+	int stride = (count + YACE_LANE_WIDTH - 1) / YACE_LANE_WIDTH * YACE_LANE_WIDTH;
+	SYACELANES *lanes = (SYACELANES *)calloc(1, sizeof(SYACELANES));
+	WORD *registers = (WORD *)calloc(21 * stride, sizeof(WORD));
+	SCHIP8 **ctx = (SCHIP8 **)malloc(count * sizeof(SCHIP8 *));
+
+	if (!lanes || !registers || !ctx || count < 1)
+	{
+		free(lanes);
+		free(registers);
+		free(ctx);
+		return NULL;
+	}
+
+	memcpy(ctx, contexts, count * sizeof(SCHIP8 *));
+	lanes->count = count;
+	lanes->stride = stride;
+	lanes->ctx = ctx;
+
+	for (i = 0; i < 16; i++)
+		lanes->V[i] = registers + i * stride;
+
+	lanes->I = registers + 16 * stride;
+	lanes->PC = registers + 17 * stride;
+	lanes->delayTimer = registers + 18 * stride;
+	lanes->soundTimer = registers + 19 * stride;
+	lanes->left = registers + 20 * stride;
+
+	for (i = 1; i < count; i++)
+	{
+		for (j = 0; j < 0x1000; j++)
+		{
+			if (ctx[i]->RAM[j] != ctx[0]->RAM[j])
+				lanes->written[j] = 1;
+		}
+	}
+
+	return lanes;
+}
+
+void YACE_FreeLanes(SYACELANES *lanes)
+{
+	if (!lanes)
+		return;
+
+	free(lanes->V[0]);
+	free(lanes->ctx);
+	free(lanes);
+}
+
+// Copies the registers of the context in the lanes
+void YACE_LaneLoad(SYACELANES *lanes, int lane)
+{
+	int i;
+	SCHIP8 *ctx = lanes->ctx[lane];
+
+	for (i = 0; i < 16; i++)
+		lanes->V[i][lane] = ctx->V[i];
+
+	lanes->I[lane] = ctx->I;
+	lanes->PC[lane] = ctx->PC;
+	lanes->delayTimer[lane] = ctx->delayTimer;
+	lanes->soundTimer[lane] = ctx->soundTimer;
+}
+
+// Copies the registers of the lane in its context
+void YACE_LaneStore(SYACELANES *lanes, int lane)
+{
+	int i;
+	SCHIP8 *ctx = lanes->ctx[lane];
+
+	for (i = 0; i < 16; i++)
+		ctx->V[i] = lanes->V[i][lane];
+
+	ctx->I = lanes->I[lane];
+	ctx->PC = lanes->PC[lane];
+	ctx->delayTimer = lanes->delayTimer[lane];
+	ctx->soundTimer = lanes->soundTimer[lane];
+}
+
+// Returns 1 if the opcode touches memory, screen, stack or keys,
+// then it runs lane by lane
+int YACE_LanesScalar(WORD opcode)
+{
+	switch (opcode & 0xF000)
+	{
+		case 0x0000:
+		case 0x2000:
+		case 0xC000:
+		case 0xD000:
+		case 0xE000: return 1;
+		case 0xF000:
+		{
+			switch (opcode & 0x00FF)
+			{
+				case 0x0A:
+				case 0x33:
+				case 0x55:
+				case 0x65: return 1;
+			}
+		} break;
+	}
+
+	return 0;
+}
+
+// Executes the next instruction of the lane with the reference interpreter
+void YACE_LaneStep(SYACELANES *lanes, int lane)
+{
+	int i;
+	SCHIP8 *ctx = lanes->ctx[lane];
+	WORD pc = lanes->PC[lane];
+	WORD opcode;
+
+	YACE_LaneStore(lanes, lane);
+	opcode = YACE_FetchOpcode(ctx);
+
+	// The lanes may store different bytes
+	if ((opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055)
+	{
+		int size = (opcode & 0x00FF) == 0x33 ? 3 : ((opcode & 0x0F00) >> 8) + 1;
+
+		for (i = 0; i < size; i++)
+			lanes->written[(ctx->I + i) & 0xFFF] = 1;
+	}
+
+	YACE_ExecuteOpcode(ctx, opcode);
+	YACE_LaneLoad(lanes, lane);
+
+	// A lane waiting for a key is idle until the next frame
+	if ((opcode & 0xF0FF) == 0xF00A && lanes->PC[lane] == pc)
+		lanes->left[lane] = 1;
+}
+
+// Runs the lanes at the target one by one, returns the next target
+int YACE_LanesStepScalar(SYACELANES *lanes, int target)
+{
+	int lane;
+	int next = 0x10000;
+
+	for (lane = 0; lane < lanes->count; lane++)
+	{
+		if (lanes->left[lane] && lanes->PC[lane] == target)
+		{
+			YACE_LaneStep(lanes, lane);
+			lanes->left[lane]--;
+		}
+
+		if (lanes->left[lane] && lanes->PC[lane] < next)
+			next = lanes->PC[lane];
+	}
+
+	return next;
+}
+
+// Runs body on each vector of lanes with some waiting at the target,
+// mask selects them and pc already points to their next instruction.
+// The lowest PC of the lanes with instructions left goes in next.
+#define YACE_LANES_KERNEL(body) \
+	for (lane = 0; lane < lanes->stride; lane += YACE_LANE_WIDTH) \
+	{ \
+		YACE_VEC left = YACE_VLoad(&lanes->left[lane]); \
+		YACE_VEC pc = YACE_VLoad(&lanes->PC[lane]); \
+		YACE_VEC mask = YACE_VAndNot(YACE_VEq(left, zero), YACE_VEq(pc, at)); \
+		if (YACE_VAny(mask)) \
+		{ \
+			pc = YACE_VAdd(pc, YACE_VAnd(mask, two)); \
+			{ body } \
+			left = YACE_VSub(left, YACE_VBit(mask)); \
+			YACE_VStore(&lanes->left[lane], left); \
+			YACE_VStore(&lanes->PC[lane], pc); \
+		} \
+		next = YACE_VMin(next, YACE_VOr(pc, YACE_VEq(left, zero))); \
+		active = YACE_VOr(active, left); \
+	}
+
+// Loads register r of the lanes
+#define YACE_LANES_REG(r) YACE_VLoad(&lanes->r[lane])
+// Stores value in register r of the selected lanes
+#define YACE_LANES_SET(r, value) \
+	YACE_VStore(&lanes->r[lane], YACE_VBlend(YACE_VLoad(&lanes->r[lane]), (value), mask))
+
+// Runs the opcode on the lanes at the target, returns the next target
+int YACE_LanesStepVector(SYACELANES *lanes, int target, WORD opcode)
+{
+	int i, lane;
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	int result = 0xFFFF;
+	YACE_VEC at = YACE_VSet(target);
+	YACE_VEC zero = YACE_VSet(0);
+	YACE_VEC two = YACE_VSet(2);
+	YACE_VEC low = YACE_VSet(0xFF);
+	YACE_VEC nn = YACE_VSet(opcode & 0x00FF);
+	YACE_VEC nnn = YACE_VSet(opcode & 0x0FFF);
+	YACE_VEC next = YACE_VSet(0xFFFF);
+	YACE_VEC active = zero;
+	WORD lowest[YACE_LANE_WIDTH];
+
+	switch (opcode & 0xF000)
+	{
+		// Jumps to address NNN.
+		case 0x1000:
+			YACE_LANES_KERNEL(pc = YACE_VBlend(pc, nnn, mask);)
+			break;
+		// Skips the next instruction if VX equals (3XNN) or doesn't equal (4XNN) NN.
+		case 0x3000:
+			YACE_LANES_KERNEL(pc = YACE_VAdd(pc, YACE_VAnd(YACE_VAnd(mask, YACE_VEq(YACE_LANES_REG(V[x]), nn)), two));)
+			break;
+		case 0x4000:
+			YACE_LANES_KERNEL(pc = YACE_VAdd(pc, YACE_VAnd(YACE_VAndNot(YACE_VEq(YACE_LANES_REG(V[x]), nn), mask), two));)
+			break;
+		// Skips the next instruction if VX equals (5XY0) or doesn't equal (9XY0) VY.
+		case 0x5000:
+			YACE_LANES_KERNEL(pc = YACE_VAdd(pc, YACE_VAnd(YACE_VAnd(mask, YACE_VEq(YACE_LANES_REG(V[x]), YACE_LANES_REG(V[y]))), two));)
+			break;
+		case 0x9000:
+			YACE_LANES_KERNEL(pc = YACE_VAdd(pc, YACE_VAnd(YACE_VAndNot(YACE_VEq(YACE_LANES_REG(V[x]), YACE_LANES_REG(V[y])), mask), two));)
+			break;
+		// Sets VX to NN.
+		case 0x6000:
+			YACE_LANES_KERNEL(YACE_LANES_SET(V[x], nn);)
+			break;
+		// Adds NN to VX.
+		case 0x7000:
+			YACE_LANES_KERNEL(YACE_LANES_SET(V[x], YACE_VAnd(YACE_VAdd(YACE_LANES_REG(V[x]), nn), low));)
+			break;
+		case 0x8000:
+		{
+			switch (opcode & 0x000F)
+			{
+				case 0x0:
+					YACE_LANES_KERNEL(YACE_LANES_SET(V[x], YACE_LANES_REG(V[y]));)
+					break;
+				case 0x1:
+					YACE_LANES_KERNEL(YACE_LANES_SET(V[x], YACE_VOr(YACE_LANES_REG(V[x]), YACE_LANES_REG(V[y])));)
+					break;
+				case 0x2:
+					YACE_LANES_KERNEL(YACE_LANES_SET(V[x], YACE_VAnd(YACE_LANES_REG(V[x]), YACE_LANES_REG(V[y])));)
+					break;
+				case 0x3:
+					YACE_LANES_KERNEL(YACE_LANES_SET(V[x], YACE_VXor(YACE_LANES_REG(V[x]), YACE_LANES_REG(V[y])));)
+					break;
+				// VF is the ninth bit of the sum
+				case 0x4:
+					YACE_LANES_KERNEL(
+						YACE_VEC sum = YACE_VAdd(YACE_LANES_REG(V[x]), YACE_LANES_REG(V[y]));
+						YACE_LANES_SET(V[0xF], YACE_VShr(sum, 8));
+						YACE_LANES_SET(V[x], YACE_VAnd(sum, low));)
+					break;
+				// VF is set when VX > VY
+				case 0x5:
+					YACE_LANES_KERNEL(
+						YACE_VEC vx = YACE_LANES_REG(V[x]);
+						YACE_VEC vy = YACE_LANES_REG(V[y]);
+						YACE_LANES_SET(V[0xF], YACE_VBit(YACE_VGt(vx, vy)));
+						YACE_LANES_SET(V[x], YACE_VAnd(YACE_VSub(vx, vy), low));)
+					break;
+				case 0x6:
+					YACE_LANES_KERNEL(
+						YACE_LANES_SET(V[0xF], YACE_VAnd(YACE_LANES_REG(V[x]), YACE_VSet(1)));
+						YACE_LANES_SET(V[x], YACE_VShr(YACE_LANES_REG(V[x]), 1));)
+					break;
+				// VF is set when VY >= VX, after VX is written
+				case 0x7:
+					YACE_LANES_KERNEL(
+						YACE_VEC vx = YACE_LANES_REG(V[x]);
+						YACE_VEC vy = YACE_LANES_REG(V[y]);
+						YACE_LANES_SET(V[x], YACE_VAnd(YACE_VSub(vy, vx), low));
+						YACE_LANES_SET(V[0xF], YACE_VBit(YACE_VNot(YACE_VGt(vx, vy))));)
+					break;
+				case 0xE:
+					YACE_LANES_KERNEL(
+						YACE_LANES_SET(V[0xF], YACE_VShr(YACE_LANES_REG(V[x]), 7));
+						YACE_LANES_SET(V[x], YACE_VAnd(YACE_VShl(YACE_LANES_REG(V[x]), 1), low));)
+					break;
+				default:
+					YACE_LANES_KERNEL(;)
+					break;
+			}
+		} break;
+		// Sets I to the address NNN.
+		case 0xA000:
+			YACE_LANES_KERNEL(YACE_LANES_SET(I, nnn);)
+			break;
+		// Jumps to the address NNN plus V0.
+		case 0xB000:
+			YACE_LANES_KERNEL(pc = YACE_VBlend(pc, YACE_VAdd(YACE_LANES_REG(V[0]), nnn), mask);)
+			break;
+		case 0xF000:
+		{
+			switch (opcode & 0x00FF)
+			{
+				case 0x07:
+					YACE_LANES_KERNEL(YACE_LANES_SET(V[x], YACE_LANES_REG(delayTimer));)
+					break;
+				case 0x15:
+					YACE_LANES_KERNEL(YACE_LANES_SET(delayTimer, YACE_LANES_REG(V[x]));)
+					break;
+				case 0x18:
+					YACE_LANES_KERNEL(YACE_LANES_SET(soundTimer, YACE_LANES_REG(V[x]));)
+					break;
+				// VF is set when I + VX > 0xFFF, then I wraps. I is 12 bits
+				// and VX 8, the sum can't carry out of the lane.
+				case 0x1E:
+					YACE_LANES_KERNEL(
+						YACE_VEC index = YACE_VAdd(YACE_LANES_REG(I), YACE_LANES_REG(V[x]));
+						YACE_VEC over = YACE_VNot(YACE_VEq(YACE_VAnd(index, YACE_VSet(0xF000)), zero));
+						YACE_LANES_SET(I, YACE_VAnd(index, YACE_VSet(0xFFF)));
+						YACE_LANES_SET(V[0xF], YACE_VBit(over));)
+					break;
+				case 0x29:
+					YACE_LANES_KERNEL(YACE_LANES_SET(I, YACE_VAdd(YACE_VShl(YACE_LANES_REG(V[x]), 2), YACE_LANES_REG(V[x])));)
+					break;
+				default:
+					YACE_LANES_KERNEL(;)
+					break;
+			}
+		} break;
+	}
+
+	if (!YACE_VAny(YACE_VNot(YACE_VEq(active, zero))))
+		return 0x10000;
+
+	YACE_VStore(lowest, next);
+	for (i = 0; i < YACE_LANE_WIDTH; i++)
+	{
+		if (lowest[i] < result)
+			result = lowest[i];
+	}
+
+	return result;
+}
+
+// Lowest PC of the lanes with instructions left
+int YACE_LanesFirst(SYACELANES *lanes)
+{
+	int lane;
+	int next = 0x10000;
+
+	for (lane = 0; lane < lanes->count; lane++)
+	{
+		if (lanes->left[lane] && lanes->PC[lane] < next)
+			next = lanes->PC[lane];
+	}
+
+	return next;
+}
+
+// Runs the given number of frames of cycles instructions on every
+// lane, like YACE_RunFrame. Returns the instructions executed by all
+// the lanes, the registers of the contexts are updated at the end.
+Uint64 YACE_RunLanes(SYACELANES *lanes, int frames, int cycles)
+{
+	int lane, frame;
+	YACE_VEC zero = YACE_VSet(0);
+
+	if (cycles > 0xFFFF)
+		cycles = 0xFFFF;
+
+	for (lane = 0; lane < lanes->count; lane++)
+		YACE_LaneLoad(lanes, lane);
+
+	for (frame = 0; frame < frames; frame++)
+	{
+		int target;
+
+		for (lane = 0; lane < lanes->stride; lane += YACE_LANE_WIDTH)
+		{
+			YACE_VEC delay = YACE_VLoad(&lanes->delayTimer[lane]);
+			YACE_VEC sound = YACE_VLoad(&lanes->soundTimer[lane]);
+
+			YACE_VStore(&lanes->delayTimer[lane], YACE_VSub(delay, YACE_VBit(YACE_VNot(YACE_VEq(delay, zero)))));
+			YACE_VStore(&lanes->soundTimer[lane], YACE_VSub(sound, YACE_VBit(YACE_VNot(YACE_VEq(sound, zero)))));
+		}
+
+		for (lane = 0; lane < lanes->count; lane++)
+			lanes->left[lane] = cycles;
+
+		target = YACE_LanesFirst(lanes);
+
+		while (target < 0x10000)
+		{
+			WORD opcode;
+
+			// Opcodes the lanes may not share, or past the end of the RAM
+			if (target > 0xFFE || lanes->written[target] || lanes->written[target + 1])
+			{
+				target = YACE_LanesStepScalar(lanes, target);
+				continue;
+			}
+
+			opcode = (lanes->ctx[0]->RAM[target] << 8) | lanes->ctx[0]->RAM[target + 1];
+
+			if (YACE_LanesScalar(opcode))
+				target = YACE_LanesStepScalar(lanes, target);
+			else
+				target = YACE_LanesStepVector(lanes, target, opcode);
+		}
+	}
+
+	for (lane = 0; lane < lanes->count; lane++)
+		YACE_LaneStore(lanes, lane);
+
+	return (Uint64)frames * cycles * lanes->count;
+}
@@ -0,0 +1,481 @@
+// *******************************************************
+// yace-aot - YACE ahead-of-time recompiler
+//
+// Copyright (c) 2014 Mainieri "Lazharous" Paolo
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+// Translates a ROM into a C translation unit implementing the
+// YACE_ENGINE_AOT engine. The code reachable from 0x200 is split
+// in basic blocks, each one becoming a label of YACE_RunAot, so
+// static jumps, calls and skips are plain gotos. Computed jumps
+// (BNNN), returns and blocks the guest wrote over go through the
+// dispatcher, which runs the interpreter when there's no block.
+//
+//   yace-aot pong.ch8 pong_aot.c
+//   cc -O2 -DYACE_AOT chip8.c pong_aot.c -lSDL2 -lGL -o yace-pong
+// *******************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define YACE_AOT_START 0x200
+#define YACE_AOT_END 0x1000
+
+// ROM loaded at 0x200
+unsigned char g_ram[YACE_AOT_END];
+int g_romEnd;
+// Addresses starting a block
+unsigned char g_label[YACE_AOT_END];
+// Bytes of translated code
+unsigned char g_code[YACE_AOT_END];
+// Addresses left to walk
+int g_pending[YACE_AOT_END];
+int g_numPending;
+
+// Returns 1 if a whole opcode of the ROM starts at the address
+int YACE_AotInRom(int address)
+{
+	return address >= YACE_AOT_START && address + 1 < g_romEnd;
+}
+
+int YACE_AotOpcode(int address)
+{
+	return (g_ram[address] << 8) | g_ram[address + 1];
+}
+
+void YACE_AotAddLabel(int address)
+{
+	if (YACE_AotInRom(address) && !g_label[address])
+	{
+		g_label[address] = 1;
+		g_pending[g_numPending++] = address;
+	}
+}
+
+// Returns 1 if the opcode is the last one of its block
+int YACE_AotEndsBlock(int opcode)
+{
+	switch (opcode & 0xF000)
+	{
+		case 0x0000: return (opcode & 0xF) == 0xE;
+		case 0x1000:
+		case 0x2000:
+		case 0x3000:
+		case 0x4000:
+		case 0x5000:
+		case 0x9000:
+		case 0xB000:
+		case 0xE000: return 1;
+		case 0xF000:
+		{
+			switch (opcode & 0x00FF)
+			{
+				case 0x0A:
+				case 0x33:
+				case 0x55: return 1;
+			}
+		} break;
+	}
+
+	return 0;
+}
+
+// Returns 1 if an idle loop of the core starts at the address
+// (see YACE_FuseInstruction): jump to self, FX07 3XNN/4XNN 1NNN
+// and EX9E/EXA1 1NNN jumping back to it
+int YACE_AotIdleLoop(int address)
+{
+	int opcode = YACE_AotOpcode(address);
+	int next = YACE_AotInRom(address + 2) ? YACE_AotOpcode(address + 2) : 0;
+	int last = YACE_AotInRom(address + 4) ? YACE_AotOpcode(address + 4) : 0;
+
+	if (opcode == (0x1000 | address))
+		return 1;
+
+	if ((opcode & 0xF0FF) == 0xF007 && last == (0x1000 | address) &&
+		((next & 0xF000) == 0x3000 || (next & 0xF000) == 0x4000) &&
+		(next & 0x0F00) == (opcode & 0x0F00))
+		return 1;
+
+	if (((opcode & 0xF0FF) == 0xE09E || (opcode & 0xF0FF) == 0xE0A1) &&
+		next == (0x1000 | address))
+		return 1;
+
+	return 0;
+}
+
+// Follows the control flow from 0x200 marking block starts
+void YACE_AotDiscover(void)
+{
+	YACE_AotAddLabel(YACE_AOT_START);
+
+	while (g_numPending)
+	{
+		int pc = g_pending[--g_numPending];
+
+		while (YACE_AotInRom(pc))
+		{
+			int opcode = YACE_AotOpcode(pc);
+
+			g_code[pc] = g_code[pc + 1] = 1;
+			pc += 2;
+
+			if (!YACE_AotEndsBlock(opcode))
+				continue;
+
+			switch (opcode & 0xF000)
+			{
+				case 0x1000:
+					YACE_AotAddLabel(opcode & 0x0FFF);
+					break;
+				case 0x2000:
+					YACE_AotAddLabel(opcode & 0x0FFF);
+					YACE_AotAddLabel(pc);
+					break;
+				case 0x3000:
+				case 0x4000:
+				case 0x5000:
+				case 0x9000:
+				case 0xE000:
+					YACE_AotAddLabel(pc);
+					YACE_AotAddLabel(pc + 2);
+					break;
+				case 0xF000:
+					YACE_AotAddLabel(pc);
+					break;
+			}
+
+			break;
+		}
+	}
+}
+
+// Continues at the given address
+void YACE_AotJump(FILE *out, int address)
+{
+	if (YACE_AotInRom(address) && g_label[address])
+		fprintf(out, "\tgoto L_%03X;\n", address);
+	else
+		fprintf(out, "\t{ ctx->PC = 0x%03X; goto dispatch; }\n", address);
+}
+
+// Emits the statements of one opcode, returns 1 if it ended the block
+int YACE_AotEmitOpcode(FILE *out, int pc, int opcode)
+{
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	int nn = opcode & 0x00FF;
+	int nnn = opcode & 0x0FFF;
+	int next = pc + 2;
+
+	fprintf(out, "\t// %03X: %04X\n", pc, opcode);
+	fprintf(out, "\tYACE_AOT_STEP(0x%03X);\n", pc);
+
+	switch (opcode & 0xF000)
+	{
+		case 0x0000:
+		{
+			if ((opcode & 0xF) == 0x0)
+				fprintf(out, "\tYACE_ClearScreen(ctx);\n");
+			else if ((opcode & 0xF) == 0xE)
+			{
+				fprintf(out, "\tctx->SP--; ctx->PC = ctx->Stack[ctx->SP & (YACE_STACK_SIZE - 1)]; goto dispatch;\n");
+				return 1;
+			}
+		} break;
+		case 0x1000:
+			YACE_AotJump(out, nnn);
+			return 1;
+		case 0x2000:
+			fprintf(out, "\tctx->Stack[ctx->SP & (YACE_STACK_SIZE - 1)] = 0x%03X; ctx->SP++;\n", next);
+			YACE_AotJump(out, nnn);
+			return 1;
+		case 0x3000:
+		case 0x4000:
+		{
+			fprintf(out, "\tif (ctx->V[%d] %s 0x%02X)\n\t", x,
+				(opcode & 0xF000) == 0x3000 ? "==" : "!=", nn);
+			YACE_AotJump(out, next + 2);
+			YACE_AotJump(out, next);
+		} return 1;
+		case 0x5000:
+		case 0x9000:
+		{
+			fprintf(out, "\tif (ctx->V[%d] %s ctx->V[%d])\n\t", x,
+				(opcode & 0xF000) == 0x5000 ? "==" : "!=", y);
+			YACE_AotJump(out, next + 2);
+			YACE_AotJump(out, next);
+		} return 1;
+		case 0x6000:
+			fprintf(out, "\tctx->V[%d] = 0x%02X;\n", x, nn);
+			break;
+		case 0x7000:
+			fprintf(out, "\tctx->V[%d] += 0x%02X;\n", x, nn);
+			break;
+		case 0x8000:
+		{
+			switch (opcode & 0x000F)
+			{
+				case 0x0: fprintf(out, "\tctx->V[%d] = ctx->V[%d];\n", x, y); break;
+				case 0x1: fprintf(out, "\tctx->V[%d] |= ctx->V[%d];\n", x, y); break;
+				case 0x2: fprintf(out, "\tctx->V[%d] &= ctx->V[%d];\n", x, y); break;
+				case 0x3: fprintf(out, "\tctx->V[%d] ^= ctx->V[%d];\n", x, y); break;
+				case 0x4:
+					fprintf(out, "\tvalue = ctx->V[%d] + ctx->V[%d];\n"
+						"\tctx->V[0xF] = (value > 0xFF);\n"
+						"\tctx->V[%d] = value;\n", x, y, x);
+					break;
+				case 0x5:
+					fprintf(out, "\tvalue = ctx->V[%d] - ctx->V[%d];\n"
+						"\tctx->V[0xF] = (value > 0);\n"
+						"\tctx->V[%d] = value;\n", x, y, x);
+					break;
+				case 0x6:
+					fprintf(out, "\tctx->V[0xF] = ctx->V[%d] & 0x0001;\n"
+						"\tctx->V[%d] >>= 1;\n", x, x);
+					break;
+				case 0x7:
+					fprintf(out, "\tvalue = ctx->V[%d] - ctx->V[%d];\n"
+						"\tctx->V[%d] = value;\n"
+						"\tctx->V[0xF] = (value >= 0);\n", y, x, x);
+					break;
+				case 0xE:
+					fprintf(out, "\tctx->V[0xF] = ctx->V[%d] >> 7;\n"
+						"\tctx->V[%d] <<= 1;\n", x, x);
+					break;
+			}
+		} break;
+		case 0xA000:
+			fprintf(out, "\tctx->I = 0x%03X;\n", nnn);
+			break;
+		case 0xB000:
+			fprintf(out, "\tctx->PC = ctx->V[0] + 0x%03X; goto dispatch;\n", nnn);
+			return 1;
+		case 0xC000:
+			fprintf(out, "\tYACE_ExecuteCXNNOpcode(ctx, 0x%04X);\n", opcode);
+			break;
+		case 0xD000:
+			fprintf(out, "\tYACE_ExecuteDXYNOpcode(ctx, 0x%04X);\n", opcode);
+			break;
+		case 0xE000:
+			// The key state belongs to the core, let it skip
+			fprintf(out, "\tctx->PC = 0x%03X; YACE_DecodeEXNNOpcode(ctx, 0x%04X); goto dispatch;\n",
+				next, opcode);
+			return 1;
+		case 0xF000:
+		{
+			switch (nn)
+			{
+				case 0x07: fprintf(out, "\tctx->V[%d] = ctx->delayTimer;\n", x); break;
+				case 0x15: fprintf(out, "\tctx->delayTimer = ctx->V[%d];\n", x); break;
+				case 0x18: fprintf(out, "\tctx->soundTimer = ctx->V[%d];\n", x); break;
+				case 0x1E:
+					fprintf(out, "\tvalue = ctx->I + ctx->V[%d];\n"
+						"\tctx->V[0xF] = (value > 0xFFF);\n"
+						"\tctx->I = value & 0xFFF;\n", x);
+					break;
+				case 0x29: fprintf(out, "\tctx->I = ctx->V[%d] * 5;\n", x); break;
+				case 0x65: fprintf(out, "\tYACE_LoadRegisters(ctx, %d);\n", x); break;
+				// FX0A runs in the core, which stops when the guest waits
+				case 0x0A:
+					fprintf(out, "\tctx->PC = 0x%03X; done += YACE_RunSlot(ctx, cycles - done + 1) - 1; goto dispatch;\n", pc);
+					return 1;
+				// FX33 and FX55 may write over code
+				case 0x33:
+				case 0x55:
+					fprintf(out, "\tctx->PC = 0x%03X; YACE_DecodeFXNNOpcode(ctx, 0x%04X); goto dispatch;\n",
+						next, opcode);
+					return 1;
+			}
+		} break;
+	}
+
+	return 0;
+}
+
+// Emits the block starting at the label
+void YACE_AotEmitBlock(FILE *out, int start)
+{
+	int pc = start;
+	int done = 0;
+
+	// Find the size first, the block ends on a terminator,
+	// on the next label or at the end of the ROM
+	while (!done)
+	{
+		done = YACE_AotEndsBlock(YACE_AotOpcode(pc));
+		pc += 2;
+
+		if (!YACE_AotInRom(pc) || g_label[pc])
+			done = 1;
+	}
+
+	fprintf(out, "L_%03X:\n", start);
+
+	if (YACE_AotIdleLoop(start))
+	{
+		fprintf(out, "\tYACE_AOT_IDLE(0x%03X);\n\n", start);
+		return;
+	}
+
+	fprintf(out, "\tYACE_AOT_BLOCK(0x%03X, %d);\n", start, pc - start);
+
+	for (pc = start, done = 0; !done; pc += 2)
+	{
+		done = YACE_AotEmitOpcode(out, pc, YACE_AotOpcode(pc));
+
+		if (!done && (!YACE_AotInRom(pc + 2) || g_label[pc + 2]))
+		{
+			YACE_AotJump(out, pc + 2);
+			done = 1;
+		}
+	}
+
+	fprintf(out, "\n");
+}
+
+void YACE_AotEmit(FILE *out, const char *romName)
+{
+	int i;
+
+	fprintf(out, "// Generated by yace-aot from %s, do not edit\n"
+		"// Build with the core: cc -O2 -DYACE_AOT chip8.c <this file>\n\n"
+		"#include <string.h>\n"
+		"#include \"chip8.h\"\n\n", romName);
+
+	fprintf(out, "// ROM the blocks were translated from\n"
+		"static const BYTE g_aotRom[%d] =\n{", g_romEnd - YACE_AOT_START);
+
+	for (i = YACE_AOT_START; i < g_romEnd; i++)
+		fprintf(out, "%s0x%02X,", (i - YACE_AOT_START) % 16 ? " " : "\n\t", g_ram[i]);
+
+	fprintf(out, "\n};\n\n"
+		"// 1 for the bytes of translated code\n"
+		"static const BYTE g_aotCode[%d] =\n{", g_romEnd - YACE_AOT_START);
+
+	for (i = YACE_AOT_START; i < g_romEnd; i++)
+		fprintf(out, "%s%d,", (i - YACE_AOT_START) % 32 ? " " : "\n\t", g_code[i]);
+
+	fprintf(out, "\n};\n\n"
+		"// Checks the code when the guest wrote over the ROM\n"
+		"#define YACE_AOT_BLOCK(address, size) \\\n"
+		"\tif (ctx->aotDirty && memcmp(&ctx->RAM[address], &g_aotRom[address - 0x200], size)) \\\n"
+		"\t\t{ ctx->PC = address; goto interpret; }\n\n"
+		"// Stops at the instruction once the budget is spent\n"
+		"#define YACE_AOT_STEP(address) \\\n"
+		"\tif (done >= cycles) { ctx->PC = address; return done; } \\\n"
+		"\tdone++\n\n"
+		"// Idle loops run through the core, which stops the engine\n"
+		"#define YACE_AOT_IDLE(address) \\\n"
+		"\tif (done >= cycles) { ctx->PC = address; return done; } \\\n"
+		"\tctx->PC = address; done += YACE_RunSlot(ctx, cycles - done); goto dispatch\n\n");
+
+	fprintf(out, "void YACE_AotFlush(SCHIP8 *ctx)\n"
+		"{\n"
+		"\tctx->aotDirty = memcmp(&ctx->RAM[0x200], g_aotRom, sizeof(g_aotRom)) != 0;\n"
+		"}\n\n"
+		"void YACE_AotInvalidate(SCHIP8 *ctx, int address, int size)\n"
+		"{\n"
+		"\tint i;\n\n"
+		"\tfor (i = address - 0x200; i < address - 0x200 + size; i++)\n"
+		"\t{\n"
+		"\t\tif (i >= 0 && i < (int)sizeof(g_aotCode) && g_aotCode[i])\n"
+		"\t\t\tctx->aotDirty = 1;\n"
+		"\t}\n"
+		"}\n\n");
+
+	fprintf(out, "int YACE_RunAot(SCHIP8 *ctx, int cycles)\n"
+		"{\n"
+		"\tint done = 0;\n"
+		"\tint value;\n\n"
+		"dispatch:\n"
+		"\tif (done >= cycles)\n"
+		"\t\treturn done;\n\n"
+		"\tswitch (ctx->PC)\n"
+		"\t{\n");
+
+	for (i = YACE_AOT_START; i < g_romEnd; i++)
+	{
+		if (g_label[i])
+			fprintf(out, "\t\tcase 0x%03X: goto L_%03X;\n", i, i);
+	}
+
+	fprintf(out, "\t}\n\n"
+		"interpret:\n"
+		"\tYACE_ExecuteOpcode(ctx, YACE_FetchOpcode(ctx));\n"
+		"\tdone++;\n"
+		"\tgoto dispatch;\n\n");
+
+	for (i = YACE_AOT_START; i < g_romEnd; i++)
+	{
+		if (g_label[i])
+			YACE_AotEmitBlock(out, i);
+	}
+
+	fprintf(out, "\t// Not reached\n"
+		"\t(void)value;\n"
+		"\treturn done;\n"
+		"}\n");
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in, *out;
+	size_t size;
+	int tail;
+
+	if (argc < 3)
+	{
+		printf("Usage: yace-aot ROM OUTPUT.c\n");
+		return 1;
+	}
+
+	in = fopen(argv[1], "rb");
+	if (!in)
+	{
+		printf("Can't open %s\n", argv[1]);
+		return 1;
+	}
+
+	// Like YACE_OpenROM, the ROM must fit from 0x200 to the end of the RAM
+	size = fread(&g_ram[YACE_AOT_START], 1, YACE_AOT_END - YACE_AOT_START, in);
+	tail = fgetc(in);
+	fclose(in);
+
+	if (size == 0 || tail != EOF)
+	{
+		printf("Can't translate %s, a ROM is 1 to %d bytes\n", argv[1], YACE_AOT_END - YACE_AOT_START);
+		return 1;
+	}
+
+	g_romEnd = YACE_AOT_START + (int)size;
+
+	out = fopen(argv[2], "w");
+	if (!out)
+	{
+		printf("Can't create %s\n", argv[2]);
+		return 1;
+	}
+
+	YACE_AotDiscover();
+	YACE_AotEmit(out, argv[1]);
+	fclose(out);
+
+	return 0;
+}
@@ -0,0 +1,449 @@
+// *******************************************************
+// yace-batch - YACE headless batch runner
+//
+// Copyright (c) 2014 Mainieri "Lazharous" Paolo
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+// Runs the jobs of a list on a pool of threads, as fast as the
+// host allows and without a window, then writes the CRC32 of the
+// ROM, the hash of the final screen and the stats of every job as
+// JSON. Each line of the list is a ROM, the frames to run and the
+// scripted input:
+//
+//   # ROM frames [frame:key+ | frame:key-]...
+//   pong.ch8 600 30:1+ 45:1-
+//
+// Keys are hex digits, pressed (+) or released (-) before the
+// frame runs. With -lanes N each job runs on N contexts in
+// lockstep (see chip8_lanes.c), the results are the first one's.
+// -clip clips the sprites at the screen edges.
+// CXNN draws from -seed, plus the lane number, so runs replay
+// the same on every host.
+// Build it with the core, without the front end:
+//
+//   cc -O2 -mavx2 -DYACE_BATCH chip8.c chip8_lanes.c tools/yace_batch.c -lSDL2 -o yace-batch
+//   yace-batch [-threads N] [-engine name] [-cycles N] [-lanes N] [-seed N] [-clip] JOBS [OUT.json]
+// *******************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "../chip8.h"
+
+#define YACE_BATCH_MAX_LINE 4096
+
+// **********************************
+// Scripted key press or release
+// **********************************
+typedef struct _SYACEINPUT
+{
+	int frame;
+	int key;
+	int down;
+} SYACEINPUT;
+
+// **********************************
+// Job of the list and its results
+// **********************************
+typedef struct _SYACEJOB
+{
+	char *rom;
+	int frames;
+	SYACEINPUT *inputs;
+	int numInputs;
+	// Results
+	int loaded;
+	Uint32 crc;
+	Uint64 instructions;
+	Uint64 hash;
+	WORD pc;
+	double ms;
+} SYACEJOB;
+
+// **********************************
+// Context of a running job, the core
+// hands it back to YACE_GetInput
+// **********************************
+typedef struct _SYACERUN
+{
+	SCHIP8 ctx;
+	// Key pressed at the start of the frame, until FX0A takes it
+	int pressed;
+} SYACERUN;
+
+SYACEJOB *g_jobs = NULL;
+int g_numJobs = 0;
+int g_engine = YACE_ENGINE_THREADED;
+// Sprites are clipped instead of wrapping around
+int g_clip = 0;
+int g_cycles = YACE_FRAME_CYCLES;
+int g_lanes = 1;
+Uint64 g_seed = YACE_RANDOM_SEED;
+// Next job to run
+SDL_atomic_t g_nextJob;
+
+// Keys come from the script, a press is returned once
+int YACE_GetInput(SCHIP8 *ctx)
+{
+	SYACERUN *run = (SYACERUN *)ctx;
+	int key = run->pressed;
+
+	run->pressed = -1;
+	return key;
+}
+
+// Applies the input of the frame to the runs, inputs are sorted by frame
+void YACE_BatchInput(SYACERUN *runs, int count, SYACEJOB *job, int frame, int *next)
+{
+	int i;
+
+	while (*next < job->numInputs && job->inputs[*next].frame <= frame)
+	{
+		SYACEINPUT *input = &job->inputs[(*next)++];
+
+		for (i = 0; i < count; i++)
+		{
+			if (input->down)
+			{
+				runs[i].ctx.Keys |= 1 << input->key;
+				runs[i].pressed = input->key;
+			}
+			else
+				runs[i].ctx.Keys &= ~(1 << input->key);
+		}
+	}
+}
+
+// Runs the frames of the job on the lanes, the input changes between runs
+void YACE_BatchRunLanes(SYACEJOB *job, SYACERUN *runs)
+{
+	int i;
+	int frame = 0;
+	int next = 0;
+	SYACELANES *lanes;
+	SCHIP8 **contexts = (SCHIP8 **)malloc(g_lanes * sizeof(SCHIP8 *));
+
+	if (!contexts)
+		return;
+
+	for (i = 0; i < g_lanes; i++)
+	{
+		if (i)
+			memcpy(runs[i].ctx.RAM, runs[0].ctx.RAM, sizeof(runs[0].ctx.RAM));
+		contexts[i] = &runs[i].ctx;
+	}
+
+	if ((lanes = YACE_CreateLanes(contexts, g_lanes)) != NULL)
+	{
+		while (frame < job->frames)
+		{
+			int until = job->frames;
+
+			YACE_BatchInput(runs, g_lanes, job, frame, &next);
+			if (next < job->numInputs && job->inputs[next].frame < until)
+				until = job->inputs[next].frame;
+
+			job->instructions += YACE_RunLanes(lanes, until - frame, g_cycles);
+			frame = until;
+		}
+
+		YACE_FreeLanes(lanes);
+	}
+
+	free(contexts);
+}
+
+void YACE_BatchRun(SYACEJOB *job)
+{
+	int i, frame;
+	int next = 0;
+	Uint64 start = SDL_GetPerformanceCounter();
+	SYACERUN *runs = (SYACERUN *)calloc(g_lanes, sizeof(SYACERUN));
+
+	if (!runs)
+		return;
+
+	for (i = 0; i < g_lanes; i++)
+	{
+		runs[i].ctx.engine = g_engine;
+		runs[i].ctx.clip = g_clip;
+		runs[i].pressed = -1;
+		YACE_Reset(&runs[i].ctx);
+		YACE_SeedRandom(&runs[i].ctx, g_seed + i);
+	}
+
+	job->loaded = YACE_OpenROM(&runs[0].ctx, job->rom);
+
+	if (job->loaded)
+	{
+		job->crc = runs[0].ctx.romCrc;
+
+		if (g_lanes > 1)
+		{
+			YACE_BatchRunLanes(job, runs);
+		}
+		else
+		{
+			for (frame = 0; frame < job->frames; frame++)
+			{
+				YACE_BatchInput(runs, 1, job, frame, &next);
+				job->instructions += YACE_RunFrame(&runs[0].ctx, g_cycles);
+			}
+		}
+
+		job->hash = YACE_HashScreen(&runs[0].ctx);
+		job->pc = runs[0].ctx.PC;
+	}
+
+	job->ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+	YACE_FreeEngines(&runs[0].ctx);
+	free(runs);
+}
+
+// Worker thread, takes jobs until the list is over
+int YACE_BatchWorker(void *data)
+{
+	int i;
+
+	while ((i = SDL_AtomicAdd(&g_nextJob, 1)) < g_numJobs)
+		YACE_BatchRun(&g_jobs[i]);
+
+	return 0;
+}
+
+int YACE_CompareInputs(const void *a, const void *b)
+{
+	return ((const SYACEINPUT *)a)->frame - ((const SYACEINPUT *)b)->frame;
+}
+
+// Parses a line of the list, returns 0 if it's malformed
+int YACE_ParseJob(SYACEJOB *job, char *line)
+{
+	char *token = strtok(line, " \t\r\n");
+
+	memset(job, 0, sizeof(SYACEJOB));
+
+	if (!token)
+		return 0;
+
+	job->rom = strdup(token);
+	token = strtok(NULL, " \t\r\n");
+
+	if (!job->rom || !token || (job->frames = atoi(token)) <= 0)
+		return 0;
+
+	while ((token = strtok(NULL, " \t\r\n")) != NULL)
+	{
+		SYACEINPUT input;
+		char sign;
+
+		if (sscanf(token, "%d:%x%c", &input.frame, &input.key, &sign) != 3 ||
+			input.key < 0 || input.key > 0xF || (sign != '+' && sign != '-'))
+			return 0;
+
+		input.down = sign == '+';
+		job->inputs = (SYACEINPUT *)realloc(job->inputs, (job->numInputs + 1) * sizeof(SYACEINPUT));
+		if (!job->inputs)
+			return 0;
+
+		job->inputs[job->numInputs++] = input;
+	}
+
+	qsort(job->inputs, job->numInputs, sizeof(SYACEINPUT), YACE_CompareInputs);
+	return 1;
+}
+
+// Reads the list of jobs, returns 0 on errors
+int YACE_LoadJobs(const char *filename)
+{
+	char line[YACE_BATCH_MAX_LINE];
+	int number = 0;
+	FILE *file = fopen(filename, "r");
+
+	if (!file)
+	{
+		fprintf(stderr, "yace-batch: can't open %s\n", filename);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), file))
+	{
+		char *start = line + strspn(line, " \t");
+
+		number++;
+		if (*start == '#' || *start == '\n' || *start == '\r' || !*start)
+			continue;
+
+		g_jobs = (SYACEJOB *)realloc(g_jobs, (g_numJobs + 1) * sizeof(SYACEJOB));
+		if (!g_jobs)
+			break;
+
+		if (!YACE_ParseJob(&g_jobs[g_numJobs], start))
+		{
+			fprintf(stderr, "yace-batch: %s:%d: expected ROM frames [frame:key+|frame:key-]...\n",
+				filename, number);
+			fclose(file);
+			return 0;
+		}
+
+		g_numJobs++;
+	}
+
+	fclose(file);
+	return g_jobs != NULL;
+}
+
+// Writes a JSON string
+void YACE_WriteString(FILE *out, const char *text)
+{
+	fputc('"', out);
+
+	for (; *text; text++)
+	{
+		if (*text == '"' || *text == '\\')
+			fprintf(out, "\\%c", *text);
+		else if ((unsigned char)*text < 0x20)
+			fprintf(out, "\\u%04x", *text);
+		else
+			fputc(*text, out);
+	}
+
+	fputc('"', out);
+}
+
+void YACE_WriteResults(FILE *out, int threads, double ms)
+{
+	int i;
+	Uint64 total = 0;
+
+	fprintf(out, "{\n\t\"jobs\": [\n");
+
+	for (i = 0; i < g_numJobs; i++)
+	{
+		SYACEJOB *job = &g_jobs[i];
+
+		total += job->instructions;
+
+		fprintf(out, "\t\t{ \"rom\": ");
+		YACE_WriteString(out, job->rom);
+
+		if (job->loaded)
+			fprintf(out, ", \"crc\": \"%08x\", \"frames\": %d, \"instructions\": %llu, \"pc\": %d, \"hash\": \"%016llx\", \"ms\": %.3f }",
+				job->crc, job->frames, (unsigned long long)job->instructions, job->pc,
+				(unsigned long long)job->hash, job->ms);
+		else
+			fprintf(out, ", \"error\": \"can't load the ROM\" }");
+
+		fprintf(out, "%s\n", i + 1 < g_numJobs ? "," : "");
+	}
+
+	fprintf(out, "\t],\n"
+		"\t\"threads\": %d,\n"
+		"\t\"lanes\": %d,\n"
+		"\t\"instructions\": %llu,\n"
+		"\t\"ms\": %.3f,\n"
+		"\t\"mips\": %.3f\n"
+		"}\n", threads, g_lanes, (unsigned long long)total, ms, ms > 0 ? total / (ms * 1000.0) : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	int threads = SDL_GetCPUCount();
+	int unknown = 0;
+	char *list = NULL;
+	char *output = NULL;
+	SDL_Thread **workers;
+	Uint64 start;
+	FILE *out = stdout;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-engine") && i + 1 < argc)
+			g_engine = YACE_EngineFromName(argv[++i]);
+		else if (!strcmp(argv[i], "-cycles") && i + 1 < argc)
+			g_cycles = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-lanes") && i + 1 < argc)
+			g_lanes = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+			g_seed = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-clip"))
+			g_clip = 1;
+		// An unknown option or one missing its value
+		else if (argv[i][0] == '-')
+			unknown = 1;
+		else if (!list)
+			list = argv[i];
+		else
+			output = argv[i];
+	}
+
+	// The profile engine keeps global counters
+	if (g_engine == YACE_ENGINE_PROFILE)
+		threads = 1;
+
+	if (!list || unknown || g_engine < 0 || threads < 1 || g_cycles < 1 || g_lanes < 1)
+	{
+		printf("Usage: yace-batch [-threads N] [-engine name] [-cycles N] [-lanes N] [-seed N] [-clip] JOBS [OUT.json]\n");
+		return 1;
+	}
+
+	if (!YACE_LoadJobs(list))
+		return 1;
+
+	if (threads > g_numJobs)
+		threads = g_numJobs;
+
+	workers = (SDL_Thread **)calloc(threads, sizeof(SDL_Thread *));
+	if (!workers)
+		return 1;
+
+	start = SDL_GetPerformanceCounter();
+
+	// The first worker is this thread
+	for (i = 1; i < threads; i++)
+		workers[i] = SDL_CreateThread(YACE_BatchWorker, "yace-batch", NULL);
+
+	YACE_BatchWorker(NULL);
+
+	for (i = 1; i < threads; i++)
+	{
+		if (workers[i])
+			SDL_WaitThread(workers[i], NULL);
+	}
+
+	if (output && !(out = fopen(output, "w")))
+	{
+		fprintf(stderr, "yace-batch: can't write %s\n", output);
+		return 1;
+	}
+
+	YACE_WriteResults(out, threads,
+		(double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+
+	if (out != stdout)
+		fclose(out);
+
+	free(workers);
+	return 0;
+}
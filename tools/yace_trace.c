@@ -0,0 +1,165 @@
+// *******************************************************
+// yace-trace - YACE execution trace decoder
+//
+// Copyright (c) 2014 Mainieri "Lazharous" Paolo
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+// Prints the binary trace written by a build with YACE_TRACE
+// (see "Execution trace" in chip8.c), one instruction a line:
+// address, opcode, mnemonic, then I, VX and VF after it.
+//
+//   cc -O2 -DYACE_TRACE chip8.c -lSDL2 -lGL -o yace
+//   yace -trace pong.trace pong.ch8
+//   cc -O2 tools/yace_trace.c -o yace-trace
+//   yace-trace pong.trace | less
+// *******************************************************
+
+#include <stdio.h>
+#include <string.h>
+
+#define YACE_TRACE_MAGIC "YACETRC1"
+#define YACE_TRACE_GAP 0xFFFF
+
+// Writes the mnemonic of the opcode
+void YACE_TraceDisassemble(char *text, int opcode)
+{
+	int x = (opcode >> 8) & 0xF;
+	int y = (opcode >> 4) & 0xF;
+	int n = opcode & 0xF;
+	int nn = opcode & 0xFF;
+	int nnn = opcode & 0xFFF;
+
+	switch (opcode & 0xF000)
+	{
+		case 0x0000:
+		{
+			if (opcode == 0x00E0)
+				strcpy(text, "CLS");
+			else if (opcode == 0x00EE)
+				strcpy(text, "RET");
+			else
+				sprintf(text, "SYS %03X", nnn);
+		} break;
+		case 0x1000: sprintf(text, "JP %03X", nnn); break;
+		case 0x2000: sprintf(text, "CALL %03X", nnn); break;
+		case 0x3000: sprintf(text, "SE V%X, %02X", x, nn); break;
+		case 0x4000: sprintf(text, "SNE V%X, %02X", x, nn); break;
+		case 0x5000: sprintf(text, "SE V%X, V%X", x, y); break;
+		case 0x6000: sprintf(text, "LD V%X, %02X", x, nn); break;
+		case 0x7000: sprintf(text, "ADD V%X, %02X", x, nn); break;
+		case 0x8000:
+		{
+			static const char *names[16] =
+			{
+				"LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+				NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL
+			};
+
+			if (names[n])
+				sprintf(text, "%s V%X, V%X", names[n], x, y);
+			else
+				sprintf(text, "??? %04X", opcode);
+		} break;
+		case 0x9000: sprintf(text, "SNE V%X, V%X", x, y); break;
+		case 0xA000: sprintf(text, "LD I, %03X", nnn); break;
+		case 0xB000: sprintf(text, "JP V0, %03X", nnn); break;
+		case 0xC000: sprintf(text, "RND V%X, %02X", x, nn); break;
+		case 0xD000: sprintf(text, "DRW V%X, V%X, %X", x, y, n); break;
+		case 0xE000:
+		{
+			if (nn == 0x9E)
+				sprintf(text, "SKP V%X", x);
+			else if (nn == 0xA1)
+				sprintf(text, "SKNP V%X", x);
+			else
+				sprintf(text, "??? %04X", opcode);
+		} break;
+		default:
+		{
+			switch (nn)
+			{
+				case 0x07: sprintf(text, "LD V%X, DT", x); break;
+				case 0x0A: sprintf(text, "LD V%X, K", x); break;
+				case 0x15: sprintf(text, "LD DT, V%X", x); break;
+				case 0x18: sprintf(text, "LD ST, V%X", x); break;
+				case 0x1E: sprintf(text, "ADD I, V%X", x); break;
+				case 0x29: sprintf(text, "LD F, V%X", x); break;
+				case 0x33: sprintf(text, "LD B, V%X", x); break;
+				case 0x55: sprintf(text, "LD [I], V%X", x); break;
+				case 0x65: sprintf(text, "LD V%X, [I]", x); break;
+				default: sprintf(text, "??? %04X", opcode); break;
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char record[8];
+	char magic[8];
+	char text[32];
+	unsigned long long instructions = 0;
+	unsigned long long lost = 0;
+	FILE *in;
+
+	if (argc < 2)
+	{
+		printf("Usage: yace-trace TRACE\n");
+		return 1;
+	}
+
+	in = fopen(argv[1], "rb");
+	if (!in)
+	{
+		printf("Can't open %s\n", argv[1]);
+		return 1;
+	}
+
+	if (fread(magic, 1, 8, in) != 8 || memcmp(magic, YACE_TRACE_MAGIC, 8))
+	{
+		printf("%s isn't a YACE trace\n", argv[1]);
+		fclose(in);
+		return 1;
+	}
+
+	while (fread(record, 1, 8, in) == 8)
+	{
+		int pc = record[0] | (record[1] << 8);
+		int opcode = record[2] | (record[3] << 8);
+		int I = record[4] | (record[5] << 8);
+
+		// The ring was full, the count spans opcode and I
+		if (pc == YACE_TRACE_GAP)
+		{
+			unsigned long count = opcode | ((unsigned long)I << 16);
+
+			printf("---- %lu instructions not recorded\n", count);
+			lost += count;
+			continue;
+		}
+
+		YACE_TraceDisassemble(text, opcode);
+		printf("%03X  %04X  %-16s I=%03X V%X=%02X VF=%02X\n",
+			pc, opcode, text, I, (opcode >> 8) & 0xF, record[6], record[7]);
+		instructions++;
+	}
+
+	fclose(in);
+	fprintf(stderr, "%llu instructions, %llu not recorded\n", instructions, lost);
+	return 0;
+}